@@ -0,0 +1,191 @@
+#include <cstdio>
+#include <filesystem>
+#include <format>
+
+#include <Luau/Compiler.h>
+#include <lua.h>
+#include <lualib.h>
+
+#include "bench_harness.h"
+
+namespace luau::debugger::bench {
+
+namespace {
+Luau::CompileOptions copts() {
+  Luau::CompileOptions result = {};
+  result.optimizationLevel = 1;
+
+  // NOTICE: debugLevel should be set to 2 to enable full debug info
+  result.debugLevel = 2;
+  result.coverageLevel = 0;
+  return result;
+}
+
+int silentPrint(lua_State*) {
+  return 0;
+}
+}  // namespace
+
+std::vector<int> findTaggedLines(std::string_view source,
+                                 std::string_view tag) {
+  std::string marker = std::format("-- @{}", tag);
+  std::vector<int> lines;
+  int line = 1;
+  std::size_t begin = 0;
+  while (begin <= source.size()) {
+    std::size_t end = source.find('\n', begin);
+    if (end == std::string_view::npos)
+      end = source.size();
+    if (source.substr(begin, end - begin).find(marker) !=
+        std::string_view::npos)
+      lines.push_back(line);
+    begin = end + 1;
+    ++line;
+  }
+  return lines;
+}
+
+Runtime::Runtime(DebuggerMode mode) {
+  L_ = luaL_newstate();
+  luaL_openlibs(L_);
+
+  // Output is not part of the measurement, the debugger still forwards it to
+  // the client
+  lua_pushcfunction(L_, silentPrint, "print");
+  lua_setglobal(L_, "print");
+
+  root_ = (std::filesystem::temp_directory_path() / "luau_debugger_bench")
+              .generic_string();
+
+  if (mode == DebuggerMode::None)
+    return;
+
+  debugger_ = std::make_unique<Debugger>(false);
+  debugger_->setRoot(root_);
+  debugger_->setDetachedMode(mode == DebuggerMode::Detached);
+  debugger_->initialize(L_);
+}
+
+Runtime::~Runtime() {
+  if (debugger_ != nullptr)
+    debugger_->release(L_);
+  lua_close(L_);
+  debugger_.reset();
+}
+
+std::string Runtime::filePath(std::string_view name) const {
+  return std::format("{}/{}.lua", root_, name);
+}
+
+bool Runtime::load(std::string_view name, std::string_view source) {
+  std::string path = filePath(name);
+  std::string chunkname = "=" + path;
+  std::string bytecode = Luau::compile(std::string(source), copts());
+  if (luau_load(L_, chunkname.c_str(), bytecode.data(), bytecode.size(), 0) !=
+      0) {
+    fprintf(stderr, "Failed to load %s: %s\n", path.c_str(),
+            lua_tostring(L_, -1));
+    lua_pop(L_, 1);
+    return false;
+  }
+
+  // NOTICE: Call debugger when file is loaded
+  if (debugger_ != nullptr)
+    debugger_->onLuaFileLoaded(L_, path, false);
+
+  if (lua_pcall(L_, 0, 1, 0) != 0) {
+    fprintf(stderr, "Failed to run %s: %s\n", path.c_str(),
+            lua_tostring(L_, -1));
+    lua_pop(L_, 1);
+    return false;
+  }
+  lua_setglobal(L_, std::string(name).c_str());
+  return true;
+}
+
+bool Runtime::call(const char* module,
+                   const char* function,
+                   std::vector<int> args) {
+  lua_getglobal(L_, module);
+  lua_getfield(L_, -1, function);
+  lua_remove(L_, -2);
+  for (int arg : args)
+    lua_pushinteger(L_, arg);
+
+  if (lua_pcall(L_, static_cast<int>(args.size()), 0, 0) != 0) {
+    fprintf(stderr, "Failed to call %s.%s: %s\n", module, function,
+            lua_tostring(L_, -1));
+    lua_pop(L_, 1);
+    return false;
+  }
+  return true;
+}
+
+Client::Client(Debugger& debugger) {
+  client_to_server_ = dap::pipe();
+  server_to_client_ = dap::pipe();
+
+  session_ = dap::Session::create();
+  session_->registerHandler([this](const dap::StoppedEvent&) {
+    std::scoped_lock lock(mutex_);
+    ++stopped_count_;
+    stopped_cv_.notify_all();
+  });
+  session_->registerHandler([](const dap::InitializedEvent&) {});
+  session_->registerHandler([](const dap::OutputEvent&) {});
+  session_->registerHandler([](const dap::InvalidatedEvent&) {});
+  session_->onError([](const char* msg) {
+    fprintf(stderr, "Bench client error: %s\n", msg);
+  });
+  session_->bind(server_to_client_, client_to_server_);
+
+  debugger.connect(
+      dap::ReaderWriter::create(client_to_server_, server_to_client_));
+
+  // The debugger is connected once the initialize response is sent, the
+  // attach request is handled after that
+  request(dap::InitializeRequest{});
+  request(dap::AttachRequest{});
+}
+
+Client::~Client() {
+  request(dap::DisconnectRequest{});
+  client_to_server_->close();
+  server_to_client_->close();
+  session_.reset();
+}
+
+dap::array<dap::Breakpoint> Client::setBreakpoints(
+    const std::string& path,
+    const std::vector<int>& lines,
+    const std::string& condition) {
+  dap::SetBreakpointsRequest request;
+  request.source.path = path;
+  dap::array<dap::SourceBreakpoint> breakpoints;
+  for (int line : lines) {
+    dap::SourceBreakpoint breakpoint;
+    breakpoint.line = line;
+    if (!condition.empty())
+      breakpoint.condition = condition;
+    breakpoints.push_back(std::move(breakpoint));
+  }
+  request.breakpoints = std::move(breakpoints);
+
+  auto response = this->request(request);
+  if (response.error)
+    return {};
+  return response.response.breakpoints;
+}
+
+bool Client::waitStopped(int count, std::chrono::milliseconds timeout) {
+  std::unique_lock lock(mutex_);
+  return stopped_cv_.wait_for(lock, timeout,
+                              [&] { return stopped_count_ >= count; });
+}
+
+int Client::stoppedCount() {
+  std::scoped_lock lock(mutex_);
+  return stopped_count_;
+}
+
+}  // namespace luau::debugger::bench
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <lua.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dap/io.h>
+#include <dap/protocol.h>
+#include <dap/session.h>
+
+#include <debugger.h>
+
+namespace luau::debugger::bench {
+
+enum class DebuggerMode {
+  // Plain lua state, the baseline
+  None,
+  // Debugger initialized in detached mode, no client connected
+  Detached,
+  // Debugger initialized with hooks installed
+  Attached,
+};
+
+// Lines of a workload marked with a `-- @tag` comment, 1-based
+std::vector<int> findTaggedLines(std::string_view source, std::string_view tag);
+
+// A lua state with an optional debugger. Workloads are loaded as files so
+// that breakpoints can be set in them.
+class Runtime {
+ public:
+  explicit Runtime(DebuggerMode mode);
+  ~Runtime();
+
+  Runtime(const Runtime&) = delete;
+  Runtime& operator=(const Runtime&) = delete;
+
+  lua_State* L() const { return L_; }
+  Debugger* debugger() const { return debugger_.get(); }
+
+  // Path passed to the debugger for a workload file name
+  std::string filePath(std::string_view name) const;
+
+  // Load and run the workload file, the table it returns is stored as global
+  // `name`
+  bool load(std::string_view name, std::string_view source);
+
+  // Call `module.function(args...)` with integer arguments, return false on
+  // lua error
+  bool call(const char* module, const char* function, std::vector<int> args);
+
+ private:
+  lua_State* L_ = nullptr;
+  std::unique_ptr<Debugger> debugger_;
+  std::string root_;
+};
+
+// DAP client connected to a debugger through in-memory pipes, without any
+// network in the path. Requests are blocking, so they should not be sent
+// from the lua thread while it is running lua code.
+class Client {
+ public:
+  explicit Client(Debugger& debugger);
+  ~Client();
+
+  Client(const Client&) = delete;
+  Client& operator=(const Client&) = delete;
+
+  template <class Request>
+  auto request(const Request& request) {
+    return session_->send(request).get();
+  }
+
+  dap::array<dap::Breakpoint> setBreakpoints(
+      const std::string& path,
+      const std::vector<int>& lines,
+      const std::string& condition = {});
+
+  // Wait until the number of stopped events reaches `count`
+  bool waitStopped(int count,
+                   std::chrono::milliseconds timeout = std::chrono::seconds(10));
+  int stoppedCount();
+
+ private:
+  std::shared_ptr<dap::ReaderWriter> client_to_server_;
+  std::shared_ptr<dap::ReaderWriter> server_to_client_;
+  std::unique_ptr<dap::Session> session_;
+
+  std::mutex mutex_;
+  std::condition_variable stopped_cv_;
+  int stopped_count_ = 0;
+};
+
+}  // namespace luau::debugger::bench
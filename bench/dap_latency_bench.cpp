@@ -0,0 +1,343 @@
+// Latency of DAP requests from an in-process client, including the handoff
+// to the lua thread and the JSON serialization of both sides.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_harness.h"
+
+namespace luau::debugger::bench {
+
+namespace {
+constexpr std::string_view kSessionSource = R"(local M = {}
+
+function M.run(size)
+  local big = {}
+  for i = 1, size do
+    big[i] = { index = i, name = "item" .. i }
+  end
+  local hits = 0
+  while not M.stop do
+    hits += 1 -- @stop
+  end
+  return hits
+end
+
+return M
+)";
+
+constexpr const char* kModule = "session";
+constexpr int kTableSize = 5000;
+
+// Names of the frame seen by evaluations on the stopped thread: `n` and
+// `hits` are locals, `M` and `calls` upvalues
+constexpr std::string_view kFrameSource = R"(local M = {}
+local calls = 0
+
+function M.run(n)
+  calls += 1
+  local hits = 0
+  while not M.stop do
+    hits += 1 -- @probe
+  end
+  return hits
+end
+
+return M
+)";
+
+constexpr const char* kFrameModule = "frame_env";
+// Not evaluated natively, it reads a local through the frame environment
+constexpr const char* kFrameCondition = "hits % 100 == 99";
+
+// Requests of the scripted sequence, replayed on every stop
+enum class Request {
+  // From the continue request to the next stopped event
+  Stop,
+  Continue,
+  Threads,
+  StackTrace,
+  Scopes,
+  // Children of the table with `kTableSize` entries
+  Variables,
+  Evaluate,
+  Count,
+};
+
+using Clock = std::chrono::steady_clock;
+using Timings = std::array<double, static_cast<int>(Request::Count)>;
+
+double secondsSince(Clock::time_point begin) {
+  return std::chrono::duration<double>(Clock::now() - begin).count();
+}
+
+template <class Fn>
+double measure(Fn&& fn) {
+  auto begin = Clock::now();
+  fn();
+  return secondsSince(begin);
+}
+
+// Continue from a stop and replay the requests of a client inspecting the
+// new stop
+bool replaySequence(Client& client, int& stopped, Timings& timings) {
+  auto at = [&timings](Request request) -> double& {
+    return timings[static_cast<int>(request)];
+  };
+
+  auto begin = Clock::now();
+  client.request(dap::ContinueRequest{});
+  at(Request::Continue) = secondsSince(begin);
+  if (!client.waitStopped(++stopped))
+    return false;
+  at(Request::Stop) = secondsSince(begin);
+
+  at(Request::Threads) =
+      measure([&] { client.request(dap::ThreadsRequest{}); });
+
+  dap::StackTraceRequest stack_trace;
+  stack_trace.threadId = 1;
+  at(Request::StackTrace) = measure([&] { client.request(stack_trace); });
+
+  dap::ScopesRequest scopes_request;
+  scopes_request.frameId = 0;
+  dap::ResponseOrError<dap::ScopesResponse> scopes;
+  at(Request::Scopes) =
+      measure([&] { scopes = client.request(scopes_request); });
+  if (scopes.error || scopes.response.scopes.empty())
+    return false;
+
+  dap::VariablesRequest locals_request;
+  locals_request.variablesReference =
+      scopes.response.scopes.front().variablesReference;
+  auto locals = client.request(locals_request);
+  if (locals.error)
+    return false;
+  auto big = std::find_if(
+      locals.response.variables.begin(), locals.response.variables.end(),
+      [](const dap::Variable& variable) { return variable.name == "big"; });
+  if (big == locals.response.variables.end())
+    return false;
+
+  dap::VariablesRequest big_request;
+  big_request.variablesReference = big->variablesReference;
+  at(Request::Variables) = measure([&] { client.request(big_request); });
+
+  dap::EvaluateRequest evaluate;
+  evaluate.expression = "big[4096].name";
+  evaluate.context = "watch";
+  evaluate.frameId = 0;
+  at(Request::Evaluate) = measure([&] { client.request(evaluate); });
+  return true;
+}
+
+double percentile(std::vector<double>& samples, double p) {
+  if (samples.empty())
+    return 0;
+  std::sort(samples.begin(), samples.end());
+  auto rank = static_cast<std::size_t>(
+      std::ceil(p * static_cast<double>(samples.size())));
+  return samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1];
+}
+
+// Each iteration replays the whole sequence, only `request` is timed
+void runLatency(benchmark::State& state, Request request) {
+  Runtime runtime(DebuggerMode::Attached);
+  if (!runtime.load(kModule, kSessionSource)) {
+    state.SkipWithError("Failed to load session script");
+    return;
+  }
+
+  Client client(*runtime.debugger());
+  client.setBreakpoints(runtime.filePath(kModule),
+                        findTaggedLines(kSessionSource, "stop"));
+  runtime.debugger()->poll();
+
+  std::thread lua(
+      [&runtime] { runtime.call(kModule, "run", {kTableSize}); });
+
+  int stopped = 1;
+  if (!client.waitStopped(stopped))
+    state.SkipWithError("Breakpoint not hit");
+
+  std::vector<double> samples;
+  Timings timings{};
+  for (auto _ : state) {
+    if (state.skipped())
+      break;
+    if (!replaySequence(client, stopped, timings)) {
+      state.SkipWithError("Request sequence failed");
+      break;
+    }
+    double seconds = timings[static_cast<int>(request)];
+    state.SetIterationTime(seconds);
+    samples.push_back(seconds * 1e6);
+  }
+
+  // Should stay flat however many stops were replayed
+  int live_refs = Debugger::liveRegistryRefs();
+  // The watch expression is compiled once and hit on every other stop
+  auto eval_cache = runtime.debugger()->evalCacheStats();
+
+  // Evaluation needs the stack trace of the break
+  dap::StackTraceRequest stack_trace;
+  stack_trace.threadId = 1;
+  client.request(stack_trace);
+  dap::EvaluateRequest stop;
+  stop.expression = "M.stop = true";
+  stop.context = "repl";
+  client.request(stop);
+  client.setBreakpoints(runtime.filePath(kModule), {});
+  client.request(dap::ContinueRequest{});
+  lua.join();
+
+  state.counters["p50_us"] = percentile(samples, 0.5);
+  state.counters["p99_us"] = percentile(samples, 0.99);
+  state.counters["live_refs"] = live_refs;
+  state.counters["eval_hits"] = static_cast<double>(eval_cache.hits_);
+  state.counters["eval_misses"] = static_cast<double>(eval_cache.misses_);
+}
+
+// Evaluation of `expression` at the top frame is `expected`
+bool evaluatesTo(Client& client,
+                 const std::string& expression,
+                 const std::string& expected,
+                 const char* context = "watch") {
+  dap::EvaluateRequest evaluate;
+  evaluate.expression = expression;
+  evaluate.context = context;
+  evaluate.frameId = 0;
+  auto response = client.request(evaluate);
+  if (response.error) {
+    fprintf(stderr, "`%s` failed: %s\n", expression.c_str(),
+            response.error.message.c_str());
+    return false;
+  }
+  if (response.response.result != expected) {
+    fprintf(stderr, "`%s` is %s, expected %s\n", expression.c_str(),
+            response.response.result.c_str(), expected.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Locals and upvalues of the stopped frame are read and written by
+// evaluations and conditions running above it on the same thread, with
+// expressions and statements. Each iteration continues to the next stop and
+// checks them.
+void runFrameEnvironment(benchmark::State& state) {
+  Runtime runtime(DebuggerMode::Attached);
+  if (!runtime.load(kFrameModule, kFrameSource)) {
+    state.SkipWithError("Failed to load frame script");
+    return;
+  }
+
+  Client client(*runtime.debugger());
+  client.setBreakpoints(runtime.filePath(kFrameModule),
+                        findTaggedLines(kFrameSource, "probe"),
+                        kFrameCondition);
+  runtime.debugger()->poll();
+
+  std::thread lua([&runtime] { runtime.call(kFrameModule, "run", {7}); });
+
+  int stopped = 1;
+  if (!client.waitStopped(stopped))
+    state.SkipWithError("Breakpoint not hit");
+
+  int iteration = 0;
+  for (auto _ : state) {
+    if (state.skipped())
+      break;
+    if (iteration++ > 0) {
+      client.request(dap::ContinueRequest{});
+      if (!client.waitStopped(++stopped)) {
+        state.SkipWithError("Breakpoint not hit");
+        break;
+      }
+    }
+
+    dap::StackTraceRequest stack_trace;
+    stack_trace.threadId = 1;
+    client.request(stack_trace);
+
+    bool ok = evaluatesTo(client, "hits % 100", "99") &&
+              evaluatesTo(client, "n", iteration == 1 ? "7" : "-1") &&
+              evaluatesTo(client, "M == frame_env", "true") &&
+              evaluatesTo(client, "calls", "1") &&
+              // Written back to the local and the upvalue, not to globals
+              evaluatesTo(client, "n = -1", "", "repl") &&
+              evaluatesTo(client, "calls += 1", "", "repl") &&
+              evaluatesTo(client, "n", "-1") &&
+              evaluatesTo(client, "calls", "2") &&
+              evaluatesTo(client, "calls -= 1", "", "repl") &&
+              // If expression and if statement
+              evaluatesTo(client, "if calls == 1 then 'one' else 'many'",
+                          "one") &&
+              evaluatesTo(client, "if calls == 1 then calls = 3 end", "",
+                          "repl") &&
+              evaluatesTo(client, "calls", "3") &&
+              evaluatesTo(client, "calls = 1", "", "repl") &&
+              evaluatesTo(client, "rawget(_G, 'n') == nil", "true") &&
+              evaluatesTo(client, "rawget(_G, 'calls') == nil", "true");
+    if (!ok) {
+      state.SkipWithError("Frame environment mismatch");
+      break;
+    }
+  }
+
+  // Stopped through the global, which does not depend on the environment
+  dap::StackTraceRequest stack_trace;
+  stack_trace.threadId = 1;
+  client.request(stack_trace);
+  dap::EvaluateRequest stop;
+  stop.expression = std::string(kFrameModule) + ".stop = true";
+  stop.context = "repl";
+  client.request(stop);
+  client.setBreakpoints(runtime.filePath(kFrameModule), {});
+  client.request(dap::ContinueRequest{});
+  lua.join();
+}
+}  // namespace
+
+BENCHMARK_CAPTURE(runLatency, stop, Request::Stop)
+    ->Name("dap/stop")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(runLatency, continue, Request::Continue)
+    ->Name("dap/continue")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(runLatency, threads, Request::Threads)
+    ->Name("dap/threads")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(runLatency, stackTrace, Request::StackTrace)
+    ->Name("dap/stackTrace")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(runLatency, scopes, Request::Scopes)
+    ->Name("dap/scopes")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(runLatency, variables, Request::Variables)
+    ->Name("dap/variables")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(runLatency, evaluate, Request::Evaluate)
+    ->Name("dap/evaluate")
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(runFrameEnvironment)
+    ->Name("dap/frame_env")
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace luau::debugger::bench
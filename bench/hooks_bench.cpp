@@ -0,0 +1,287 @@
+// Overhead of the debugger hooks on lua workloads, compared with a lua state
+// without debugger.
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "bench_harness.h"
+
+namespace luau::debugger::bench {
+
+namespace {
+// Lines are tagged for breakpoints:
+//  - `hot`: executed on every operation of a workload
+//  - `cold`: never executed
+//  - `step`: the line where step in starts
+constexpr std::string_view kWorkloadSource = R"(local M = {}
+
+function M.numeric(n)
+  local acc = 0
+  for i = 1, n do
+    acc = acc + i * 0.5 -- @hot
+  end
+  return acc
+end
+
+function M.tables(n)
+  local ring = {}
+  for i = 1, n do
+    ring[i % 64 + 1] = { x = i, y = i * 2 } -- @hot
+  end
+  return #ring
+end
+
+local function descend(depth)
+  if depth == 0 then -- @hot
+    return 0
+  end
+  return descend(depth - 1) + 1
+end
+
+function M.recursion(n)
+  local total = 0
+  for _ = 1, n // 100 do
+    total += descend(99)
+  end
+  return total
+end
+
+function M.cowrap(n)
+  local ping = coroutine.wrap(function()
+    while true do
+      coroutine.yield() -- @hot
+    end
+  end)
+  for _ = 1, n do
+    ping()
+  end
+end
+
+function M.coresume(n)
+  local co = coroutine.create(function()
+    while true do
+      coroutine.yield() -- @hot
+    end
+  end)
+  for _ = 1, n do
+    coroutine.resume(co)
+  end
+end
+
+function M.print(n)
+  for i = 1, n do
+    print(i) -- @hot
+  end
+end
+
+function M.cold()
+  return 0 -- @cold
+end
+
+function M.stepping()
+  local steps = 0
+  while not M.stop do
+    steps += 1 -- @step
+  end
+  return steps
+end
+
+return M
+)";
+
+constexpr const char* kModule = "workloads";
+
+// Always false, `n` is nil in the coroutines
+constexpr const char* kFalseCondition = "n == -1";
+
+struct Workload {
+  const char* name_;
+  // Hook path stressed by the workload
+  const char* hook_;
+  int ops_;
+};
+
+constexpr Workload kWorkloads[] = {
+    {"numeric", "interrupt", 100000},  {"tables", "interrupt", 100000},
+    {"recursion", "interrupt", 100000}, {"cowrap", "cowrap", 10000},
+    {"coresume", "coresume", 10000},    {"print", "print", 10000},
+};
+
+struct Config {
+  const char* name_;
+  DebuggerMode mode_;
+  bool connect_;
+  // Set breakpoints on lines with this tag
+  const char* breakpoints_ = nullptr;
+  const char* condition_ = nullptr;
+};
+
+constexpr Config kConfigs[] = {
+    {"none", DebuggerMode::None, false},
+    {"detached", DebuggerMode::Detached, false},
+    {"attached", DebuggerMode::Attached, true},
+    {"cold_breakpoint", DebuggerMode::Attached, true, "cold"},
+    {"hot_condition", DebuggerMode::Attached, true, "hot", kFalseCondition},
+};
+
+std::string benchmarkName(const Workload& workload, const Config& config) {
+  return std::string("hooks/") + workload.name_ + "/" + config.name_;
+}
+
+void runWorkload(benchmark::State& state,
+                 const Workload& workload,
+                 const Config& config) {
+  Runtime runtime(config.mode_);
+  if (!runtime.load(kModule, kWorkloadSource)) {
+    state.SkipWithError("Failed to load workloads");
+    return;
+  }
+
+  std::unique_ptr<Client> client;
+  if (config.connect_) {
+    client = std::make_unique<Client>(*runtime.debugger());
+    if (config.breakpoints_ != nullptr) {
+      client->setBreakpoints(
+          runtime.filePath(kModule),
+          findTaggedLines(kWorkloadSource, config.breakpoints_),
+          config.condition_ != nullptr ? config.condition_ : "");
+    }
+    // Breakpoints are installed by the lua thread
+    runtime.debugger()->poll();
+  }
+
+  for (auto _ : state) {
+    if (!runtime.call(kModule, workload.name_, {workload.ops_})) {
+      state.SkipWithError("Workload failed");
+      break;
+    }
+  }
+
+  state.SetLabel(config.breakpoints_ != nullptr && config.condition_ != nullptr
+                     ? "debugbreak"
+                     : workload.hook_);
+  state.counters["per_op"] = benchmark::Counter(
+      workload.ops_, benchmark::Counter::kIsIterationInvariantRate |
+                         benchmark::Counter::kInvert);
+}
+
+// Round trip of a step in request, from the request to the stopped event
+void runStepIn(benchmark::State& state) {
+  Runtime runtime(DebuggerMode::Attached);
+  if (!runtime.load(kModule, kWorkloadSource)) {
+    state.SkipWithError("Failed to load workloads");
+    return;
+  }
+
+  Client client(*runtime.debugger());
+  client.setBreakpoints(runtime.filePath(kModule),
+                        findTaggedLines(kWorkloadSource, "step"));
+  runtime.debugger()->poll();
+
+  std::thread lua([&runtime] { runtime.call(kModule, "stepping", {}); });
+
+  int stopped = 1;
+  if (!client.waitStopped(stopped))
+    state.SkipWithError("Breakpoint not hit");
+
+  for (auto _ : state) {
+    if (state.skipped())
+      break;
+    client.request(dap::StepInRequest{});
+    if (!client.waitStopped(++stopped)) {
+      state.SkipWithError("Step in timed out");
+      break;
+    }
+  }
+
+  // Evaluation needs the stack trace of the break
+  dap::StackTraceRequest stack_trace;
+  stack_trace.threadId = 1;
+  client.request(stack_trace);
+  dap::EvaluateRequest stop;
+  stop.expression = "M.stop = true";
+  stop.context = "repl";
+  client.request(stop);
+  client.setBreakpoints(runtime.filePath(kModule), {});
+  client.request(dap::ContinueRequest{});
+  lua.join();
+
+  state.SetLabel("debugstep/debugbreak");
+}
+
+// Console output followed by the slowdown of each configuration relative to
+// the lua state without debugger
+class SlowdownReporter : public benchmark::ConsoleReporter {
+ public:
+  void ReportRuns(const std::vector<Run>& runs) override {
+    ConsoleReporter::ReportRuns(runs);
+    for (const auto& run : runs) {
+      if (run.run_type == Run::RT_Iteration && !run.skipped)
+        times_[run.benchmark_name()] = run.GetAdjustedRealTime();
+    }
+  }
+
+  void Finalize() override {
+    ConsoleReporter::Finalize();
+
+    std::string table;
+    for (const auto& workload : kWorkloads) {
+      auto baseline = times_.find(benchmarkName(workload, kConfigs[0]));
+      if (baseline == times_.end() || baseline->second <= 0)
+        continue;
+      for (const auto& config : kConfigs) {
+        auto it = times_.find(benchmarkName(workload, config));
+        if (it == times_.end())
+          continue;
+        char line[128];
+        std::snprintf(line, sizeof(line), "  %-12s %-16s %6.2fx\n",
+                      workload.name_, config.name_,
+                      it->second / baseline->second);
+        table += line;
+      }
+    }
+    if (!table.empty())
+      GetOutputStream() << "\nSlowdown relative to `none`:\n" << table;
+  }
+
+ private:
+  std::map<std::string, double> times_;
+};
+}  // namespace
+
+}  // namespace luau::debugger::bench
+
+int main(int argc, char** argv) {
+  using namespace luau::debugger;
+  using namespace luau::debugger::bench;
+
+  log::install([](std::string_view) {},
+               [](std::string_view msg) { fprintf(stderr, "%s", msg.data()); });
+
+  for (const auto& workload : kWorkloads) {
+    for (const auto& config : kConfigs) {
+      benchmark::RegisterBenchmark(
+          benchmarkName(workload, config).c_str(),
+          [&workload, &config](benchmark::State& state) {
+            runWorkload(state, workload, config);
+          })
+          ->Unit(benchmark::kMicrosecond);
+    }
+  }
+  benchmark::RegisterBenchmark("hooks/step_in", runStepIn)
+      ->Unit(benchmark::kMicrosecond)
+      ->UseRealTime();
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  SlowdownReporter reporter;
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  benchmark::Shutdown();
+  return 0;
+}
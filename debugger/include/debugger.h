@@ -1,8 +1,12 @@
 #pragma once
 
 #include <lua.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string_view>
 
 namespace dap {
@@ -42,8 +46,17 @@ class DebugBridge;
   HANDLER(StepOut)                 \
   HANDLER(Evaluate)                \
   HANDLER(Pause)                   \
+  HANDLER(Cancel)                  \
   HANDLER(Disconnect)
 
+// Counters of the cache of compiled watch, hover and repl expressions
+struct EvalCacheStats {
+  std::uint64_t hits_ = 0;
+  std::uint64_t misses_ = 0;
+  // Size of the cached expressions and their bytecode
+  std::size_t bytes_ = 0;
+};
+
 enum class DebugSession {
   Launch,
   Attach,
@@ -56,6 +69,43 @@ class Debugger {
   void initialize(lua_State* L);
   void setFileExtension(std::string_view extension);
 
+  // Keep the debugger dormant until a client is connected: no callbacks
+  // and no replaced global functions. Hooks are installed on connection and
+  // removed on disconnection, by the lua thread: hosts should call `poll`,
+  // e.g. scheduled from the wake-up handler, for a connection to take
+  // effect. Should be called before `initialize`.
+  // NOTICE: not compatible with `stop_on_entry`, entry breakpoint needs hooks.
+  void setDetachedMode(bool enable);
+
+  // Requests from the client, e.g. breakpoint changes, are processed in lua
+  // interrupts. Hosts whose lua runtime may stay idle for a long time should
+  // call `poll` from the lua thread to process them.
+  void poll();
+
+  // Called from the debugger thread when a request is waiting to be
+  // processed, hosts can schedule a `poll` in their event loop from it.
+  // Can be called from any thread, the handler should not call it again.
+  void setWakeUpHandler(std::function<void()> handler);
+
+  // Strings and `__tostring` results longer than `length` are truncated in
+  // variables, watch and hover. The full value is available by evaluating
+  // it in the debug console or copying it.
+  void setMaxValueLength(std::size_t length);
+
+  // Values expanded with `__iter` or `__getters` list at most `entries`
+  // fields and run their lua code for at most `time`. Partial fields end
+  // with a `more...` marker.
+  void setExpansionLimits(std::size_t entries, std::chrono::milliseconds time);
+
+  // Compiled expressions are cached up to `bytes`, 1MB by default. Applied on
+  // the lua thread.
+  void setEvalCacheCapacity(std::size_t bytes);
+  EvalCacheStats evalCacheStats() const;
+
+  // Number of lua registry references held by the debugger, it should not
+  // grow with the number of stops in a session.
+  static int liveRegistryRefs();
+
   // NOTE: this function should be called before `lua_close`
   void release(lua_State* L);
 
@@ -64,6 +114,10 @@ class Debugger {
   bool listen(int port);
   bool stop();
 
+  // Serve a client connected through `rw` instead of the network server,
+  // e.g. an in-process client bound to `dap::pipe`
+  void connect(const std::shared_ptr<dap::ReaderWriter>& rw);
+
   void onLuaFileLoaded(lua_State* L, std::string_view path, bool is_entry);
   void onError(std::string_view msg, lua_State* L);
 
@@ -79,7 +133,10 @@ class Debugger {
 #undef REGISTER_HANDLER
 
   void closeSession();
-  void invalidateVariables();
+  // Invalidate the variables touched by a change in the scope `reference`
+  void invalidateVariables(int reference);
+  // Invalidate the variables touched by a statement run at frame `frame`
+  void invalidateFrameVariables(int frame);
 
  private:
   friend class DebugBridge;
@@ -90,6 +147,13 @@ class Debugger {
   std::unique_ptr<DebugBridge> debug_bridge_;
 
   DebugSession session_type_ = DebugSession::Attach;
+
+  // Scope of the setVariable request being answered, read once its
+  // response is sent. Only accessed in DAP thread.
+  int set_variable_reference_ = 0;
+  // Frame of the repl evaluate request being answered, nullopt for other
+  // contexts. Only accessed in DAP thread.
+  std::optional<int> repl_frame_;
 };
 
 }  // namespace luau::debugger
\ No newline at end of file
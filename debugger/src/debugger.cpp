@@ -48,6 +48,40 @@ void Debugger::setRoot(std::string_view root) {
   debug_bridge_->fileMapping().setRootDirectory(root);
 }
 
+void Debugger::setDetachedMode(bool enable) {
+  debug_bridge_->setDetachedMode(enable);
+}
+
+void Debugger::poll() {
+  debug_bridge_->poll();
+}
+
+void Debugger::setWakeUpHandler(std::function<void()> handler) {
+  debug_bridge_->setWakeUpHandler(std::move(handler));
+}
+
+void Debugger::setMaxValueLength(std::size_t length) {
+  debug_bridge_->setFormatLimits({length, length});
+}
+
+void Debugger::setExpansionLimits(std::size_t entries,
+                                  std::chrono::milliseconds time) {
+  debug_bridge_->setExpansionLimits({entries, time});
+}
+
+void Debugger::setEvalCacheCapacity(std::size_t bytes) {
+  debug_bridge_->setEvalCacheCapacity(bytes);
+}
+
+EvalCacheStats Debugger::evalCacheStats() const {
+  const auto& cache = debug_bridge_->compileCache();
+  return {cache.hits(), cache.misses(), cache.bytes()};
+}
+
+int Debugger::liveRegistryRefs() {
+  return lua_utils::liveRefs();
+}
+
 void Debugger::setFileExtension(std::string_view extension) {
   debug_bridge_->fileMapping().setFileExtension(extension);
 }
@@ -67,11 +101,16 @@ bool Debugger::listen(int port) {
 
 bool Debugger::stop() {
   closeSession();
-  server_->stop();
+  if (server_ != nullptr)
+    server_->stop();
   debug_bridge_.reset();
   return true;
 }
 
+void Debugger::connect(const std::shared_ptr<dap::ReaderWriter>& rw) {
+  onClientConnected(rw);
+}
+
 void Debugger::onLuaFileLoaded(lua_State* L,
                                std::string_view path,
                                bool is_entry) {
@@ -145,6 +184,8 @@ void Debugger::registerInitializeHandler() {
     response.supportsDelayedStackTraceLoading = false;
     response.supportsSetVariable = true;
     response.supportsConditionalBreakpoints = true;
+    response.supportsClipboardContext = true;
+    response.supportsCancelRequest = true;
     return response;
   });
   session_->registerSentHandler(
@@ -198,9 +239,9 @@ void Debugger::registerSetBreakpointsHandler() {
         if (!file_path.has_value())
           return dap::Error("Invalid file path");
 
-        debug_bridge_->setBreakPoints(file_path.value(), request.breakpoints);
-
         dap::SetBreakpointsResponse response;
+        response.breakpoints = debug_bridge_->setBreakPoints(
+            file_path.value(), request.breakpoints);
         return response;
       });
 }
@@ -244,12 +285,14 @@ void Debugger::registerScopesHandler() {
 }
 
 void Debugger::registerVariablesHandler() {
+  // Responded from the lua thread, so that a cancel request can be handled
+  // while the variables are listed
   session_->registerHandler(
-      [&](const dap::VariablesRequest& request)
-          -> dap::ResponseOrError<dap::VariablesResponse> {
+      [&](const dap::VariablesRequest& request,
+          std::function<void(dap::VariablesResponse)> respond) {
         DEBUGGER_LOG_INFO("Server received variables request from client: {}",
                           dap_utils::toString(request));
-        return debug_bridge_->getVariables(request.variablesReference);
+        debug_bridge_->getVariables(request, std::move(respond));
       });
 }
 
@@ -259,12 +302,14 @@ void Debugger::registerSetVariableHandler() {
           -> dap::ResponseOrError<dap::SetVariableResponse> {
         DEBUGGER_LOG_INFO("Server received setVariable request from client: {}",
                           dap_utils::toString(request));
+        set_variable_reference_ =
+            static_cast<int>(request.variablesReference);
         return debug_bridge_->setVariable(request);
       });
   session_->registerSentHandler(
       [&](const dap::ResponseOrError<dap::SetVariableResponse>& res) {
         if (!res.error)
-          invalidateVariables();
+          invalidateVariables(set_variable_reference_);
       });
 }
 
@@ -293,20 +338,20 @@ void Debugger::registerStepOutHandler() {
 }
 
 void Debugger::registerEvaluateHandler() {
-  static bool should_invalidate = false;
   session_->registerHandler([&](const dap::EvaluateRequest& request)
                                 -> dap::ResponseOrError<dap::EvaluateResponse> {
-    should_invalidate =
-        request.context.has_value() && request.context.value() == "repl";
+    repl_frame_.reset();
+    if (request.context.has_value() && request.context.value() == "repl")
+      repl_frame_ = static_cast<int>(request.frameId.value(0));
     DEBUGGER_LOG_INFO("Server received evaluate request from client: {}",
                       dap_utils::toString(request));
     return debug_bridge_->evaluate(request);
   });
   session_->registerSentHandler(
       [&](const dap::ResponseOrError<dap::EvaluateResponse>& res) {
-        // Invalidate variables
-        if (!res.error && should_invalidate)
-          invalidateVariables();
+        // Only repl statements may change variables
+        if (!res.error && repl_frame_.has_value())
+          invalidateFrameVariables(*repl_frame_);
       });
 }
 
@@ -318,11 +363,33 @@ void Debugger::registerPauseHandler() {
   });
 }
 
-void Debugger::invalidateVariables() {
+void Debugger::registerCancelHandler() {
+  session_->registerHandler([&](const dap::CancelRequest& request) {
+    DEBUGGER_LOG_INFO("Server received cancel request from client: {}",
+                      dap_utils::toString(request));
+    // Safe to call in different thread. cppdap does not give the seq of
+    // requests to handlers, the expansion in progress is the only request
+    // that can be cancelled.
+    debug_bridge_->cancelExpansion();
+    return dap::CancelResponse{};
+  });
+}
+
+void Debugger::invalidateVariables(int reference) {
+  if (session_) {
+    dap::InvalidatedEvent event{.areas = std::vector<std::string>{"variables"}};
+    if (auto frame = debug_bridge_->updateVariables(reference))
+      event.stackFrameId = *frame;
+    session_->send(event);
+  }
+}
+
+void Debugger::invalidateFrameVariables(int frame) {
   if (session_) {
-    debug_bridge_->updateVariables();
-    session_->send(
-        dap::InvalidatedEvent{.areas = std::vector<std::string>{"variables"}});
+    dap::InvalidatedEvent event{.areas = std::vector<std::string>{"variables"}};
+    if (auto only = debug_bridge_->updateFrameVariables(frame))
+      event.stackFrameId = *only;
+    session_->send(event);
   }
 }
 
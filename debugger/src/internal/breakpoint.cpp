@@ -1,12 +1,264 @@
+#include <format>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <Luau/Lexer.h>
+#include <lapi.h>
+#include <ldebug.h>
+#include <lobject.h>
+#include <lstate.h>
 #include <lua.h>
 
 #include <internal/breakpoint.h>
 #include <internal/log.h>
 #include <internal/utils.h>
+#include <internal/utils/break_env.h>
 #include <internal/utils/lua_utils.h>
 
 namespace luau::debugger {
 
+class BreakPoint::NativeCondition {
+ public:
+  // Return nullptr if `condition` is not a name or a field path compared
+  // with a constant
+  static std::unique_ptr<NativeCondition> parse(const std::string& condition);
+
+  // Result of the condition in the frame running in `L`, nullopt if it's
+  // left to the compiled condition, e.g. when a metamethod may be involved
+  std::optional<bool> evaluate(lua_State* L);
+
+ private:
+  enum class Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+  // Where the first name is read from, resolved once per proto and pc
+  struct Slot {
+    enum class Kind { Local, Upvalue, Global };
+    Kind kind_ = Kind::Global;
+    // Register of locals, index of upvalues
+    int index_ = 0;
+  };
+
+  void resolve(const Proto* p, int pc);
+  bool pushOperand(lua_State* L, CallInfo* ci) const;
+  std::optional<bool> compare(lua_State* L) const;
+
+ private:
+  std::string root_;
+  std::vector<std::string> fields_;
+  Op op_ = Op::Equal;
+  lua_utils::Literal constant_;
+
+  const Proto* proto_ = nullptr;
+  const LocVar* locvars_ = nullptr;
+  int pc_ = -1;
+  Slot slot_;
+};
+
+std::unique_ptr<BreakPoint::NativeCondition> BreakPoint::NativeCondition::parse(
+    const std::string& condition) {
+  Luau::Allocator allocator;
+  Luau::AstNameTable names(allocator);
+  Luau::Lexer lexer(condition.data(), condition.size(), names);
+  lexer.setSkipComments(true);
+
+  auto native = std::unique_ptr<NativeCondition>(new NativeCondition());
+
+  // Names separated by dots
+  const auto* token = &lexer.next();
+  if (token->type != Luau::Lexeme::Name)
+    return nullptr;
+  native->root_ = token->name;
+  for (token = &lexer.next(); token->type == '.'; token = &lexer.next()) {
+    if (lexer.next().type != Luau::Lexeme::Name)
+      return nullptr;
+    native->fields_.emplace_back(lexer.current().name);
+  }
+
+  if (token->type == Luau::Lexeme::Equal)
+    native->op_ = Op::Equal;
+  else if (token->type == Luau::Lexeme::NotEqual)
+    native->op_ = Op::NotEqual;
+  else if (token->type == '<')
+    native->op_ = Op::Less;
+  else if (token->type == Luau::Lexeme::LessEqual)
+    native->op_ = Op::LessEqual;
+  else if (token->type == '>')
+    native->op_ = Op::Greater;
+  else if (token->type == Luau::Lexeme::GreaterEqual)
+    native->op_ = Op::GreaterEqual;
+  else
+    return nullptr;
+
+  // Constant, string escapes and number forms not handled by `parseLiteral`
+  // are left to the compiled condition
+  std::string literal;
+  token = &lexer.next();
+  if (token->type == '-') {
+    literal = "-";
+    token = &lexer.next();
+    if (token->type != Luau::Lexeme::Number)
+      return nullptr;
+  }
+  switch (token->type) {
+    case Luau::Lexeme::Number:
+      literal += std::string_view(token->data, token->length);
+      break;
+    case Luau::Lexeme::QuotedString:
+      literal = std::format("\"{}\"",
+                            std::string_view(token->data, token->length));
+      break;
+    case Luau::Lexeme::ReservedTrue:
+      literal = "true";
+      break;
+    case Luau::Lexeme::ReservedFalse:
+      literal = "false";
+      break;
+    case Luau::Lexeme::ReservedNil:
+      literal = "nil";
+      break;
+    default:
+      return nullptr;
+  }
+  if (lexer.next().type != Luau::Lexeme::Eof)
+    return nullptr;
+
+  auto constant = lua_utils::parseLiteral(literal);
+  if (!constant.has_value())
+    return nullptr;
+  native->constant_ = std::move(*constant);
+  return native;
+}
+
+std::optional<bool> BreakPoint::NativeCondition::evaluate(lua_State* L) {
+  CallInfo* ci = L->ci;
+  if (!isLua(ci))
+    return std::nullopt;
+
+  const Proto* p = clvalue(ci->func)->l.p;
+  int pc = pcRel(ci->savedpc, p);
+  if (p != proto_ || p->locvars != locvars_ || pc != pc_)
+    resolve(p, pc);
+
+  lua_utils::StackGuard guard(L);
+  if (!pushOperand(L, ci))
+    return std::nullopt;
+  return compare(L);
+}
+
+void BreakPoint::NativeCondition::resolve(const Proto* p, int pc) {
+  proto_ = p;
+  locvars_ = p->locvars;
+  pc_ = pc;
+  slot_ = {};
+
+  // Later locals shadow the earlier ones with the same name
+  for (int i = p->sizelocvars - 1; i >= 0; --i) {
+    const LocVar& var = p->locvars[i];
+    if (var.startpc <= pc && pc < var.endpc && root_ == getstr(var.varname)) {
+      slot_ = {Slot::Kind::Local, var.reg};
+      return;
+    }
+  }
+  for (int i = 0; i < p->sizeupvalues; ++i) {
+    if (p->upvalues[i] != nullptr && root_ == getstr(p->upvalues[i])) {
+      slot_ = {Slot::Kind::Upvalue, i};
+      return;
+    }
+  }
+}
+
+bool BreakPoint::NativeCondition::pushOperand(lua_State* L,
+                                              CallInfo* ci) const {
+  lua_checkstack(L, 2);
+  switch (slot_.kind_) {
+    case Slot::Kind::Local:
+      luaA_pushobject(L, ci->base + slot_.index_);
+      break;
+    case Slot::Kind::Upvalue:
+      luaA_pushobject(L, ci->func);
+      lua_getupvalue(L, -1, slot_.index_ + 1);
+      break;
+    case Slot::Kind::Global:
+      luaA_pushobject(L, ci->func);
+      lua_getfenv(L, -1);
+      if (!lua_utils::rawGetField(L, -1, root_))
+        return false;
+      break;
+  }
+
+  for (const auto& field : fields_) {
+    if (!lua_utils::rawGetField(L, -1, field))
+      return false;
+  }
+  return true;
+}
+
+std::optional<bool> BreakPoint::NativeCondition::compare(lua_State* L) const {
+  int type = lua_type(L, -1);
+  if (op_ == Op::Equal || op_ == Op::NotEqual) {
+    // Integers may compare equal to numbers
+    if (type == LUA_TINTEGER)
+      return std::nullopt;
+
+    bool equal = false;
+    if (type == constant_.type_) {
+      switch (type) {
+        case LUA_TNIL:
+          equal = true;
+          break;
+        case LUA_TBOOLEAN:
+          equal = (lua_toboolean(L, -1) != 0) == constant_.boolean_;
+          break;
+        case LUA_TNUMBER:
+          equal = lua_tonumber(L, -1) == constant_.number_;
+          break;
+        case LUA_TSTRING: {
+          std::size_t length = 0;
+          const char* value = lua_tolstring(L, -1, &length);
+          equal = std::string_view(value, length) == constant_.string_;
+          break;
+        }
+      }
+    }
+    return equal == (op_ == Op::Equal);
+  }
+
+  // Other operands raise errors or call `__lt` and `__le`
+  int order = 0;
+  if (type == LUA_TNUMBER && constant_.type_ == LUA_TNUMBER) {
+    double value = lua_tonumber(L, -1);
+    // Comparisons with NaN are all false
+    if (value != value || constant_.number_ != constant_.number_)
+      return false;
+    order = value < constant_.number_ ? -1 : value > constant_.number_;
+  } else if (type == LUA_TSTRING && constant_.type_ == LUA_TSTRING) {
+    std::size_t length = 0;
+    const char* value = lua_tolstring(L, -1, &length);
+    order = std::string_view(value, length).compare(constant_.string_);
+  } else {
+    return std::nullopt;
+  }
+
+  switch (op_) {
+    case Op::Less:
+      return order < 0;
+    case Op::LessEqual:
+      return order <= 0;
+    case Op::Greater:
+      return order > 0;
+    case Op::GreaterEqual:
+      return order >= 0;
+    default:
+      return std::nullopt;
+  }
+}
+
+BreakPoint::Condition::~Condition() {
+  for (auto [L, ref] : closures_)
+    lua_utils::unref(L, ref);
+}
+
 BreakPoint BreakPoint::create(int line) {
   BreakPoint bp;
   bp.line_ = line;
@@ -21,8 +273,22 @@ int BreakPoint::targetLine() const {
   return target_line_;
 }
 
-void BreakPoint::setCondition(std::string condition) {
+BreakPoint::CompileResult BreakPoint::setCondition(std::string condition) {
   condition_ = std::move(condition);
+  compiled_ = nullptr;
+  if (condition_.empty())
+    return CompileResult::success(true);
+
+  std::string error;
+  auto bytecode = lua_utils::compile(condition_, error);
+  if (!bytecode.has_value())
+    return CompileResult::error(error);
+
+  // The compiled condition is kept for values the native one can't compare
+  compiled_ = std::make_shared<Condition>();
+  compiled_->bytecode_ = std::move(bytecode.value());
+  compiled_->native_ = NativeCondition::parse(condition_);
+  return CompileResult::success(true);
 }
 
 const std::string& BreakPoint::condition() const {
@@ -30,16 +296,27 @@ const std::string& BreakPoint::condition() const {
 }
 
 BreakPoint::HitResult BreakPoint::hit(lua_State* L) const {
-  if (condition_.empty())
+  if (compiled_ == nullptr)
     return HitResult::success(true);
 
+  if (compiled_->native_ != nullptr) {
+    if (auto result = compiled_->native_->evaluate(L))
+      return HitResult::success(*result);
+  }
+
   lua_utils::StackGuard guard(L);
-  if (!lua_utils::pushBreakEnv(L, 0))
+  lua_utils::BreakEnv break_env(L, 0);
+  if (!break_env.push(L))
     return HitResult::error("Invalid condition: environment not found");
 
-  auto result = lua_utils::eval(L, condition_, -1);
+  int env = lua_absindex(L, -1);
+  if (!pushCondition(L))
+    return HitResult::error("Invalid condition: failed to load");
+
+  auto result = lua_utils::callWithEnv(L, env);
   if (!result.has_value())
-    return HitResult::error("Invalid condition: syntax error");
+    return HitResult::error(std::format("Invalid condition: {}",
+                                        lua_utils::type::toString(L, -1)));
 
   if (result.value() != 1)
     return HitResult::error("Invalid condition: must return a boolean value");
@@ -50,6 +327,41 @@ BreakPoint::HitResult BreakPoint::hit(lua_State* L) const {
   return HitResult::success(lua_toboolean(L, -1) != 0);
 }
 
+void BreakPoint::release(lua_State* L) {
+  if (compiled_ == nullptr)
+    return;
+
+  auto& closures = compiled_->closures_;
+  auto it = closures.find(lua_mainthread(L));
+  if (it == closures.end())
+    return;
+
+  lua_utils::unref(it->first, it->second);
+  closures.erase(it);
+}
+
+bool BreakPoint::pushCondition(lua_State* L) const {
+  auto& closures = compiled_->closures_;
+  lua_State* main_vm = lua_mainthread(L);
+  lua_checkstack(L, 1);
+
+  auto it = closures.find(main_vm);
+  if (it != closures.end()) {
+    lua_getref(L, it->second);
+    return true;
+  }
+
+  const auto& bytecode = compiled_->bytecode_;
+  if (luau_load(L, condition_.c_str(), bytecode.data(), bytecode.size(), 0) !=
+      0) {
+    lua_pop(L, 1);
+    return false;
+  }
+
+  closures.emplace(main_vm, lua_utils::ref(L, -1));
+  return true;
+}
+
 int BreakPoint::enable(lua_State* L, int func_index, bool enable) {
   lua_checkstack(L, 1);
   lua_getref(L, func_index);
@@ -60,4 +372,4 @@ int BreakPoint::enable(lua_State* L, int func_index, bool enable) {
   return result;
 }
 
-}  // namespace luau::debugger
\ No newline at end of file
+}  // namespace luau::debugger
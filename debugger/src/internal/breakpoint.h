@@ -1,6 +1,8 @@
 #pragma once
 #include <lua.h>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
 #include <internal/utils.h>
 
@@ -12,15 +14,41 @@ class BreakPoint {
   int line() const;
   int targetLine() const;
   int enable(lua_State* L, int func_index, bool enable);
-  void setCondition(std::string condition);
+
+  // Compile the condition once, the compiled closure is loaded lazily for
+  // each lua VM when the breakpoint is hit
+  using CompileResult = utils::Result<bool>;
+  CompileResult setCondition(std::string condition);
   const std::string& condition() const;
 
   using HitResult = utils::Result<bool>;
   HitResult hit(lua_State* L) const;
 
+  // Release the condition closure cached for the lua VM
+  void release(lua_State* L);
+
+ private:
+  // Push the condition closure of the lua VM, load it if not cached yet
+  bool pushCondition(lua_State* L) const;
+
+  // Comparison of a local, upvalue or field with a constant, e.g.
+  // `state.phase ~= "idle"`, evaluated without entering the VM
+  class NativeCondition;
+
+  // Shared by all copies of the breakpoint
+  struct Condition {
+    ~Condition();
+    std::string bytecode_;
+    // main thread -> reference of the loaded closure
+    std::unordered_map<lua_State*, int> closures_;
+    // nullptr if the condition is not in the native subset
+    std::unique_ptr<NativeCondition> native_;
+  };
+
  private:
   std::string condition_;
+  std::shared_ptr<Condition> compiled_;
   int line_ = 0;
   int target_line_ = -1;
 };
-}  // namespace luau::debugger
\ No newline at end of file
+}  // namespace luau::debugger
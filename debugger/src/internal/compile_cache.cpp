@@ -0,0 +1,49 @@
+#include <internal/compile_cache.h>
+#include <internal/utils/lua_utils.h>
+
+namespace luau::debugger {
+
+std::optional<std::string_view> CompileCache::get(const std::string& code,
+                                                  std::string& error) {
+  if (auto it = index_.find(code); it != index_.end()) {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return entries_.front().bytecode_;
+  }
+
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  auto bytecode = lua_utils::compile(code, error);
+  if (!bytecode.has_value())
+    return std::nullopt;
+
+  auto& entry =
+      entries_.emplace_front(Entry{.code_ = code, .bytecode_ = *bytecode});
+  index_.emplace(entry.code_, entries_.begin());
+  bytes_.fetch_add(sizeOf(entry), std::memory_order_relaxed);
+  evict();
+  return entry.bytecode_;
+}
+
+void CompileCache::setCapacity(std::size_t bytes) {
+  capacity_ = bytes;
+  evict();
+}
+
+void CompileCache::clear() {
+  index_.clear();
+  entries_.clear();
+  bytes_.store(0, std::memory_order_relaxed);
+}
+
+void CompileCache::evict() {
+  auto bytes = bytes_.load(std::memory_order_relaxed);
+  while (bytes > capacity_ && entries_.size() > 1) {
+    auto& entry = entries_.back();
+    bytes -= sizeOf(entry);
+    index_.erase(entry.code_);
+    entries_.pop_back();
+  }
+  bytes_.store(bytes, std::memory_order_relaxed);
+}
+
+}  // namespace luau::debugger
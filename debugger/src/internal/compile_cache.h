@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace luau::debugger {
+
+// LRU cache of the bytecode of evaluated expressions keyed by their text, so
+// that watch expressions are not compiled again on every stop. It's bounded
+// by the total size of the cached bytecode. Only used in main thread, the
+// counters can be read from any thread.
+class CompileCache {
+ public:
+  static constexpr std::size_t kDefaultCapacity = 1024 * 1024;
+
+  // Bytecode of `code`, compiled on a miss. The view is valid until the next
+  // call. Compile errors are set to `error` and not cached.
+  std::optional<std::string_view> get(const std::string& code,
+                                      std::string& error);
+
+  // Evict the least recently used entries until `bytes` fit
+  void setCapacity(std::size_t bytes);
+  void clear();
+
+  std::uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  std::uint64_t misses() const {
+    return misses_.load(std::memory_order_relaxed);
+  }
+  std::size_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Entry {
+    std::string code_;
+    std::string bytecode_;
+  };
+
+  static std::size_t sizeOf(const Entry& entry) {
+    return entry.code_.size() + entry.bytecode_.size();
+  }
+
+  // Keep the most recent entry even if it's larger than the capacity, it's
+  // returned to the caller
+  void evict();
+
+ private:
+  std::size_t capacity_ = kDefaultCapacity;
+
+  // Most recently used first, keys of the index are views of `code_`
+  std::list<Entry> entries_;
+  std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+
+  std::atomic<std::uint64_t> hits_ = 0;
+  std::atomic<std::uint64_t> misses_ = 0;
+  std::atomic<std::size_t> bytes_ = 0;
+};
+
+}  // namespace luau::debugger
@@ -6,6 +6,7 @@
 #include <thread>
 #include <unordered_map>
 
+#include <lobject.h>
 #include <lstate.h>
 #include <lua.h>
 #include <lualib.h>
@@ -21,6 +22,7 @@
 #include <internal/lua_statics.h>
 #include <internal/scope.h>
 #include <internal/utils.h>
+#include <internal/utils/break_env.h>
 #include <internal/utils/lua_types.h>
 #include <internal/variable.h>
 #include <internal/vm_registry.h>
@@ -46,22 +48,24 @@ DebugBridge* DebugBridge::get(lua_State* L) {
 void DebugBridge::initialize(lua_State* L) {
   vm_registry_.registerVM(L);
 
-  initializeCallbacks(L);
-
-  lua_utils::replaceOrCreateFunction(L, "print", LuaStatics::print);
   lua_utils::replaceOrCreateFunction(L, "debug", "break_here",
                                      LuaStatics::breakHere);
-  lua_utils::replaceOrCreateFunction(L, "coroutine", "wrap",
-                                     LuaStatics::cowrap);
-  lua_utils::replaceOrCreateFunction(L, "coroutine", "resume",
-                                     LuaStatics::coresume);
 
-  lua_singlestep(L, true);
+  if (!detached_mode_ || attached_)
+    installHooks(L);
 }
 
 void DebugBridge::release(lua_State* L) {
   vm_registry_.releaseVM(L);
   variable_registry_.clear();
+  variable_registry_.releaseCache();
+  step_traps_.release(L);
+  std::erase_if(sources_, [L](const auto& source) {
+    if (source.second.L_ != L)
+      return false;
+    unpinSource(source.second);
+    return true;
+  });
   for (auto& [_, file] : files_)
     file.removeRef(L);
 }
@@ -73,6 +77,28 @@ void DebugBridge::initializeCallbacks(lua_State* L) {
   cb->userthread = LuaStatics::userthread;
 }
 
+void DebugBridge::installHooks(lua_State* L) {
+  initializeCallbacks(L);
+
+  lua_utils::replaceOrCreateFunction(L, "print", LuaStatics::print);
+  lua_utils::replaceOrCreateFunction(L, "coroutine", "wrap",
+                                     LuaStatics::cowrap);
+  lua_utils::replaceOrCreateFunction(L, "coroutine", "resume",
+                                     LuaStatics::coresume);
+}
+
+void DebugBridge::uninstallHooks(lua_State* L) {
+  lua_Callbacks* cb = lua_callbacks(L);
+  cb->debugbreak = nullptr;
+  cb->debugstep = nullptr;
+  cb->interrupt = nullptr;
+  cb->userthread = nullptr;
+
+  lua_utils::restoreFunction(L, "print", LuaStatics::print);
+  lua_utils::restoreFunction(L, "coroutine", "wrap", LuaStatics::cowrap);
+  lua_utils::restoreFunction(L, "coroutine", "resume", LuaStatics::coresume);
+}
+
 bool DebugBridge::isDebugBreak() {
   std::scoped_lock lock(break_mutex_);
   return !resume_;
@@ -81,6 +107,11 @@ bool DebugBridge::isDebugBreak() {
 void DebugBridge::onDebugBreak(lua_State* L,
                                lua_Debug* ar,
                                BreakReason reason) {
+  // Ignore breaks from code evaluated during a break, `break_vm_` is only
+  // written by the main thread
+  if (break_vm_ != nullptr)
+    return;
+
   std::unique_lock<std::mutex> lock(break_mutex_);
 
   dap::StoppedEvent event{.reason = stopReasonToString(reason)};
@@ -123,17 +154,17 @@ StackTraceResponse DebugBridge::getStackTrace(std::int64_t threadId) {
   if (!isDebugBreak())
     return StackTraceResponse{};
 
-  lua_State* L = threadId == 1
-                     ? break_vm_
-                     : vm_registry_.getThread(static_cast<int>(threadId));
-
+  // Frames and the registry are owned by main thread, which may be listing
+  // variables of a previous request
   StackTraceResponse response;
-  lua_utils::DisableDebugStep _(break_vm_);
-
-  auto frames = updateStackFrames(L);
-
-  response.stackFrames = frames;
-  response.totalFrames = response.stackFrames.size();
+  executeInMainThread([&] {
+    lua_State* L = threadId == 1
+                       ? break_vm_
+                       : vm_registry_.getThread(static_cast<int>(threadId));
+    lua_utils::DisableDebugStep _(break_vm_);
+    response.stackFrames = updateStackFrames(L);
+    response.totalFrames = response.stackFrames.size();
+  });
   return response;
 }
 
@@ -141,52 +172,74 @@ ScopesResponse DebugBridge::getScopes(int frameId) {
   if (!isDebugBreak())
     return {};
 
-  if (frameId < 0 || frameId >= stack_frames_.size())
-    return {};
-
-  const auto& frame = stack_frames_[frameId];
-
   ScopesResponse response;
-
-  response.scopes = {
-      dap::Scope{.expensive = false,
-                 .name = "Local",
-                 .variablesReference =
-                     variable_registry_.getLocalScope(frame.L_, frame.depth_)
-                         .getKey()},
-      dap::Scope{.expensive = false,
-                 .name = "Upvalues",
-                 .variablesReference =
-                     variable_registry_.getUpvalueScope(frame.L_, frame.depth_)
-                         .getKey()},
-      dap::Scope{
-          .expensive = false,
-          .name = "Globals",
-          .variablesReference = variable_registry_.getGlobalScope().getKey()},
-  };
+  executeInMainThread([&] {
+    if (frameId < 0 || frameId >= stack_frames_.size())
+      return;
+    const auto& frame = stack_frames_[frameId];
+
+    // Only descriptors of the scopes are registered, variables are fetched
+    // when they are requested
+    response.scopes = {
+        dap::Scope{.expensive = false,
+                   .name = "Local",
+                   .variablesReference =
+                       variable_registry_
+                           .getLocalScope(frame.thread_, frame.level_)
+                           .getKey()},
+        dap::Scope{.expensive = false,
+                   .name = "Upvalues",
+                   .variablesReference =
+                       variable_registry_
+                           .getUpvalueScope(frame.thread_, frame.level_)
+                           .getKey()},
+        dap::Scope{.expensive = false,
+                   .name = "Globals",
+                   .variablesReference =
+                       variable_registry_.getGlobalScope(break_vm_).getKey()},
+    };
+  });
   return response;
 }
 
-VariablesResponse DebugBridge::getVariables(int reference) {
-  if (!isDebugBreak())
-    return {};
+void DebugBridge::getVariables(
+    const VariablesRequest& request,
+    std::function<void(VariablesResponse)> respond) {
+  if (!isDebugBreak()) {
+    respond({});
+    return;
+  }
 
-  std::vector<Variable>* variables;
-  executeInMainThread([&]() {
+  VariablesPage page;
+  if (request.filter.has_value()) {
+    if (*request.filter == "indexed")
+      page.filter_ = VariablesPage::Filter::Indexed;
+    else if (*request.filter == "named")
+      page.filter_ = VariablesPage::Filter::Named;
+  }
+  page.start_ = static_cast<int>(request.start.value(0));
+  page.count_ = static_cast<int>(request.count.value(0));
+
+  auto reference = static_cast<int>(request.variablesReference);
+  postToMainThread([this, reference, page, respond = std::move(respond)]() {
+    VariablesResponse response;
     lua_utils::DisableDebugStep _(break_vm_);
-    variables = variable_registry_.getVariables(Scope(reference), true);
+    variable_registry_.visitVariables(
+        Scope(reference), page, [&response](const Variable& variable) {
+          auto& item = response.variables.emplace_back(dap::Variable{
+              .name = std::string(variable.getName()),
+              .type = std::string(variable.getType()),
+              .value = std::string(variable.getValue()),
+              .variablesReference = variable.getReference()});
+          if (!variable.getEvaluateName().empty())
+            item.evaluateName = std::string(variable.getEvaluateName());
+          if (auto size = variable.getTableSize()) {
+            item.indexedVariables = dap::integer(size->elements_);
+            item.namedVariables = dap::integer(size->fields_);
+          }
+        });
+    respond(std::move(response));
   });
-  if (variables == nullptr)
-    return VariablesResponse{};
-
-  VariablesResponse response;
-  for (const auto& variable : (*variables))
-    response.variables.emplace_back(
-        dap::Variable{.name = std::string(variable.getName()),
-                      .type = variable.getType(),
-                      .value = std::string(variable.getValue()),
-                      .variablesReference = variable.getScope().getKey()});
-  return response;
 }
 
 ResponseOrError<SetVariableResponse> DebugBridge::setVariable(
@@ -194,30 +247,44 @@ ResponseOrError<SetVariableResponse> DebugBridge::setVariable(
   if (!isDebugBreak())
     return {};
 
-  auto result = variable_registry_.getVariables(request.variablesReference);
-  if (result == nullptr)
-    return Error{"Variable scope not found"};
-
-  auto& scope = result->first;
-  auto& variables = result->second;
-  auto it = std::find_if(variables.begin(), variables.end(),
-                         [&request](const auto& variable) {
-                           return variable.getName() == request.name;
-                         });
-  if (it == variables.end())
-    return Error{"Variable not found"};
-
   ResponseOrError<SetVariableResponse> response;
   executeInMainThread([&]() {
+    auto* registered = variable_registry_.findScope(
+        static_cast<int>(request.variablesReference));
+    if (registered == nullptr) {
+      response = Error{"Variable scope not found"};
+      return;
+    }
+
+    const Scope& scope = *registered;
+    auto& variables = *variable_registry_.getVariables(scope, false);
+    auto it = std::find_if(variables.begin(), variables.end(),
+                           [&request](const auto& variable) {
+                             return variable.getName() == request.name;
+                           });
+
+    // Elements of plain tables are not registered with the fields
+    std::optional<Variable> element;
+    if (it == variables.end()) {
+      element = variable_registry_.findElement(scope, request.name);
+      if (!element.has_value()) {
+        response = Error{"Variable not found"};
+        return;
+      }
+    }
+    Variable& variable = element.has_value() ? *element : *it;
+
     std::string new_value;
     try {
-      new_value = it->setValue(scope, request.value);
+      new_value = variable.setValue(scope, request.value,
+                                    variable_registry_.formatLimits());
     } catch (const std::exception& e) {
       response = Error{e.what()};
       return;
     }
-    response = SetVariableResponse{
-        .value = new_value, .variablesReference = it->getScope().getKey()};
+    response =
+        SetVariableResponse{.value = new_value,
+                            .variablesReference = variable.getReference()};
   });
 
   return response;
@@ -236,6 +303,7 @@ void DebugBridge::pause() {
   if (isDebugBreak())
     return;
   should_pause_ = true;
+  interrupt_tasks_.signal();
 }
 
 void DebugBridge::onLuaFileLoaded(lua_State* L,
@@ -251,6 +319,7 @@ void DebugBridge::onLuaFileLoaded(lua_State* L,
 
     DEBUGGER_LOG_INFO("[onLuaFileLoaded] New file loaded: {}", normalized_path);
     it = files_.emplace(normalized_path, std::move(file)).first;
+    forgetUnknownSources();
   } else {
     DEBUGGER_LOG_INFO(
         "[onLuaFileLoaded] File already loaded, replace with new: {}",
@@ -259,20 +328,51 @@ void DebugBridge::onLuaFileLoaded(lua_State* L,
     it->second.addRef(LuaFileRef(L));
   }
 
+  if (auto* func = lua_utils::getLuaFunction(L, -1))
+    sources_[func->l.p->source] = SourceInfo{&it->second, lua_mainthread(L)};
+
   if (is_entry && stop_on_entry_) {
     it->second.addBreakPoint(1);
+    entry_file_ = &it->second;
     file_mapping_.setEntryPath(std::move(normalized_path));
   }
 }
 
-void DebugBridge::setBreakPoints(
+array<Breakpoint> DebugBridge::setBreakPoints(
     std::string_view path,
     optional<array<SourceBreakpoint>> breakpoints) {
   std::string normalized_path = file_mapping_.normalize(path);
+
+  // Compile conditions in the DAP thread, so the errors can be reported in
+  // the response and the lua runtime never compiles them on hit
+  array<Breakpoint> verified;
+  std::unordered_map<int, BreakPoint> bps;
+  bool clear_all = !breakpoints.has_value();
+  if (breakpoints.has_value()) {
+    for (const auto& breakpoint : *breakpoints) {
+      auto& result = verified.emplace_back(
+          Breakpoint{.line = breakpoint.line, .verified = true});
+      auto bp = BreakPoint::create(breakpoint.line);
+      if (breakpoint.condition.has_value()) {
+        auto compiled = bp.setCondition(breakpoint.condition.value());
+        if (compiled.isError()) {
+          DEBUGGER_LOG_ERROR("[setBreakPoint] invalid condition at {}:{}: {}",
+                             normalized_path, static_cast<int>(breakpoint.line),
+                             compiled.error());
+          result.verified = false;
+          result.message =
+              std::format("Invalid condition: {}", compiled.error());
+          continue;
+        }
+      }
+      bps.emplace(static_cast<int>(breakpoint.line), std::move(bp));
+    }
+  }
+
   interrupt_tasks_.post([this, normalized_path = std::move(normalized_path),
-                         breakpoints = std::move(breakpoints)] {
+                         clear_all, bps = std::move(bps)] {
     // Clear all breakpoints
-    if (!breakpoints.has_value()) {
+    if (clear_all) {
       DEBUGGER_LOG_INFO("[setBreakPoint] clear all breakpoints: {}",
                         normalized_path);
       auto it = files_.find(normalized_path);
@@ -283,21 +383,14 @@ void DebugBridge::setBreakPoints(
     }
 
     auto it = files_.find(normalized_path);
-    std::unordered_map<int, BreakPoint> bps;
-    for (const auto& breakpoint : *breakpoints) {
-      auto bp = BreakPoint::create(breakpoint.line);
-      if (breakpoint.condition.has_value())
-        bp.setCondition(breakpoint.condition.value());
-      bps.emplace(static_cast<int>(breakpoint.line), std::move(bp));
-    }
-
     if (it == files_.end()) {
       DEBUGGER_LOG_INFO("[setBreakPoint] create new file with breakpoints: {}",
                         normalized_path);
 
       File file;
       file.setPath(normalized_path);
-      it = files_.emplace(normalized_path, File()).first;
+      it = files_.emplace(normalized_path, std::move(file)).first;
+      forgetUnknownSources();
     } else
       DEBUGGER_LOG_INFO("[setBreakPoint] file already loaded: {}",
                         normalized_path);
@@ -305,57 +398,99 @@ void DebugBridge::setBreakPoints(
     auto& file = it->second;
     file.setBreakPoints(bps);
   });
+
+  return verified;
 }
 
-BreakContext DebugBridge::getBreakContext(lua_State* L) const {
-  lua_Debug ar;
-  lua_getinfo(L, 0, "sl", &ar);
+BreakContext DebugBridge::getBreakContext(lua_State* L, lua_Debug* ar) const {
+  int line = 0;
+  if (ar != nullptr)
+    line = ar->currentline;
+  else {
+    lua_Debug current;
+    lua_getinfo(L, 0, "l", &current);
+    line = current.currentline;
+  }
+
   return BreakContext{
-      .source_ = ar.source,
-      .line_ = ar.currentline,
+      .proto_ = lua_utils::getProto(L, 0),
+      .line_ = line,
       .depth_ = getStackDepth(L),
       .L_ = L,
   };
 }
 
 int DebugBridge::getStackDepth(lua_State* L) const {
-  int depth = lua_stackdepth(L);
-  auto* parent = vm_registry_.getParent(L);
-  while (parent != nullptr) {
-    depth += lua_stackdepth(parent);
-    parent = vm_registry_.getParent(parent);
-  }
-  return depth;
+  return vm_registry_.getResumeDepth() + lua_stackdepth(L);
 }
 
 bool DebugBridge::isBreakOnEntry(lua_State* L) {
-  auto context = getBreakContext(L);
-  auto it = files_.find(file_mapping_.entryPath());
-  if (it == files_.end())
+  if (entry_file_ == nullptr || findFile(L, 0) != entry_file_)
     return false;
-  auto* bp = it->second.findBreakPoint(1);
+
+  auto* bp = entry_file_->findBreakPoint(1);
   if (bp == nullptr)
     return false;
 
-  return file_mapping_.isEntryPath(context.source_) &&
-         context.line_ == bp->targetLine();
+  lua_Debug ar;
+  lua_getinfo(L, 0, "l", &ar);
+  return ar.currentline == bp->targetLine();
 }
 
 void DebugBridge::interruptUpdate(lua_State* L) {
+  if (trap_callee_) {
+    lua_utils::StackGuard guard(L, 1);
+    if (lua_utils::pushCallee(L))
+      step_traps_.trapFunction(L, -1);
+  }
+
+  // Fast path, nothing posted from DAP thread
+  if (!interrupt_tasks_.isPending())
+    return;
+
   interrupt_tasks_.process();
+
   if (should_pause_.exchange(false))
     onDebugBreak(L, nullptr, BreakReason::Pause);
 }
 
+void DebugBridge::poll() {
+  if (!interrupt_tasks_.isPending())
+    return;
+
+  interrupt_tasks_.process();
+
+  // Pause needs a running lua function, leave it to the interrupt
+  if (should_pause_)
+    interrupt_tasks_.signal(false);
+}
+
 void DebugBridge::clearBreakPoints() {
   for (auto& [_, file] : files_)
     file.clearBreakPoints();
 }
 
 void DebugBridge::onConnect(dap::Session* session) {
-  std::scoped_lock lock(break_mutex_);
-  session_ = session;
-  session_cv_.notify_one();
+  {
+    std::scoped_lock lock(break_mutex_);
+    session_ = session;
+    session_cv_.notify_one();
+  }
+
+  if (!detached_mode_)
+    return;
+
+  // Callbacks and VMs are owned by the lua thread, no interrupt is installed
+  // yet so the hooks are installed by `poll`, which the wake-up handler asks
+  // the host to call
+  interrupt_tasks_.post([this] {
+    if (attached_)
+      return;
+    DEBUGGER_LOG_INFO("[onConnect] Install debugger hooks");
+    for (lua_State* L : vm_registry_.getVMs())
+      installHooks(L);
+    attached_ = true;
+  });
 }
 
 void DebugBridge::onDisconnect() {
@@ -364,6 +499,22 @@ void DebugBridge::onDisconnect() {
   processSingleStep(nullptr);
   resumeInternal();
   session_ = nullptr;
+
+  if (!detached_mode_)
+    return;
+
+  interrupt_tasks_.post([this] {
+    {
+      // Reconnected before hooks are removed
+      std::scoped_lock lock(break_mutex_);
+      if (session_ != nullptr)
+        return;
+    }
+    DEBUGGER_LOG_INFO("[onDisconnect] Remove debugger hooks");
+    for (lua_State* L : vm_registry_.getVMs())
+      uninstallHooks(L);
+    attached_ = false;
+  });
 }
 
 void DebugBridge::stepIn() {
@@ -371,9 +522,11 @@ void DebugBridge::stepIn() {
     return;
 
   auto old_ctx = getBreakContext(break_vm_);
-  processSingleStep([this, old_ctx](lua_State* L, lua_Debug* ar) -> bool {
-    return old_ctx != getBreakContext(L);
-  });
+  processSingleStep(
+      [this, old_ctx](lua_State* L, lua_Debug* ar) -> bool {
+        return old_ctx != getBreakContext(L, ar);
+      },
+      StepKind::In);
   resumeInternal();
 }
 
@@ -382,10 +535,11 @@ void DebugBridge::stepOut() {
     return;
 
   auto old_ctx = getBreakContext(break_vm_);
-  processSingleStep([this, old_ctx](lua_State* L, lua_Debug* ar) -> bool {
-    auto ctx = getBreakContext(L);
-    return ctx.depth_ < old_ctx.depth_;
-  });
+  processSingleStep(
+      [this, old_ctx](lua_State* L, lua_Debug* ar) -> bool {
+        return getStackDepth(L) < old_ctx.depth_;
+      },
+      StepKind::Out);
   resumeInternal();
 }
 
@@ -394,39 +548,74 @@ void DebugBridge::stepOver() {
     return;
 
   auto old_ctx = getBreakContext(break_vm_);
-  processSingleStep([this, old_ctx](lua_State* L, lua_Debug* ar) -> bool {
-    // Step over yield boundary
-    if (vm_registry_.isAlive(old_ctx.L_) && old_ctx.L_->status == LUA_YIELD)
-      return false;
-
-    auto ctx = getBreakContext(L);
-
-    if (L != old_ctx.L_ && !vm_registry_.isChild(old_ctx.L_, L))
-      return false;
-
-    // Normal step over
-    return (ctx.depth_ == old_ctx.depth_ && ctx.line_ != old_ctx.line_) ||
-           ctx.depth_ < old_ctx.depth_;
-  });
+  processSingleStep(
+      [this, old_ctx](lua_State* L, lua_Debug* ar) -> bool {
+        // Step over yield boundary
+        if (vm_registry_.isAlive(old_ctx.L_) &&
+            old_ctx.L_->status == LUA_YIELD)
+          return false;
+
+        auto ctx = getBreakContext(L, ar);
+
+        if (L != old_ctx.L_ && !vm_registry_.isChild(old_ctx.L_, L))
+          return false;
+
+        // Normal step over, deeper frames are recursive calls of trapped
+        // functions
+        return (ctx.depth_ == old_ctx.depth_ && ctx.line_ != old_ctx.line_) ||
+               ctx.depth_ < old_ctx.depth_;
+      },
+      StepKind::Over);
   resumeInternal();
 }
 
-void DebugBridge::processSingleStep(SingleStepProcessor processor) {
-  enableDebugStep(processor != nullptr);
-  single_step_processor_ = processor;
-}
+void DebugBridge::processSingleStep(SingleStepProcessor processor,
+                                    StepKind kind) {
+  bool enable = processor != nullptr;
+  single_step_processor_ = std::move(processor);
 
-void DebugBridge::enableDebugStep(bool enable) {
-  if (break_vm_ == nullptr)
-    return;
-  lua_State* L = vm_registry_.getRoot(break_vm_);
-  auto callbacks = lua_callbacks(L);
-  if (!enable) {
-    callbacks->debugstep = nullptr;
-    return;
+  // Lua states can only be modified in the main thread
+  auto update = [this, enable, kind] { enableDebugStep(enable, kind); };
+  if (isDebugBreak())
+    executeInMainThread(update);
+  else
+    interrupt_tasks_.post(update);
+}
+
+void DebugBridge::enableDebugStep(bool enable, StepKind kind) {
+  bool single_step = enable && kind == StepKind::In;
+  for (lua_State* L : vm_registry_.getVMs())
+    lua_callbacks(L)->debugstep = single_step ? LuaStatics::debugstep : nullptr;
+
+  // Only takes effect when the interpreter loop is entered, e.g. coroutines
+  // resumed and functions called from C while stepping. Threads created while
+  // stepping inherit the flag from their parent.
+  vm_registry_.setSingleStep(single_step);
+  trap_callee_ = single_step;
+
+  // Removing traps also disables breakpoints on the same lines
+  if (!step_traps_.empty()) {
+    step_traps_.clear();
+    for (auto& [_, file] : files_)
+      file.enableBreakPoints();
   }
 
-  callbacks->debugstep = LuaStatics::debugstep;
+  // Step out returns to the callers, the current function is not trapped
+  if (enable && break_vm_ != nullptr)
+    trapActiveFrames(break_vm_, kind == StepKind::Out);
+}
+
+void DebugBridge::trapActiveFrames(lua_State* L, bool skip_current) {
+  for (lua_State* thread : vm_registry_.getAncestors(L)) {
+    int depth = lua_stackdepth(thread);
+    for (int level = 0; level < depth; ++level) {
+      if (skip_current && lua_utils::getProto(thread, level) != nullptr) {
+        skip_current = false;
+        continue;
+      }
+      step_traps_.trapFrame(thread, level);
+    }
+  }
 }
 
 void DebugBridge::resumeInternal() {
@@ -437,7 +626,7 @@ void DebugBridge::resumeInternal() {
     should_pause_ = false;
   }
 
-  resume_cv_.notify_one();
+  resume_cv_.notify_all();
 }
 
 ResponseOrError<EvaluateResponse> DebugBridge::evaluate(
@@ -459,6 +648,8 @@ ResponseOrError<EvaluateResponse> DebugBridge::evaluate(
       response = evaluateWatch(request);
     else if (context == "hover")
       response = evaluateHover(request);
+    else if (context == "clipboard")
+      response = evalWithEnv(request, false);
     else {
       DEBUGGER_LOG_ERROR("[evaluate] Invalid evaluate context: {}", context);
       response = Error{"Invalid evaluate context"};
@@ -469,65 +660,90 @@ ResponseOrError<EvaluateResponse> DebugBridge::evaluate(
 
 ResponseOrError<EvaluateResponse> DebugBridge::evaluateRepl(
     const EvaluateRequest& request) {
-  return evalWithEnv(request);
+  return evalWithEnv(request, false);
 }
 
 ResponseOrError<EvaluateResponse> DebugBridge::evaluateWatch(
     const EvaluateRequest& request) {
-  return evalWithEnv(request);
+  return evalWithEnv(request, true);
 }
 
 ResponseOrError<EvaluateResponse> DebugBridge::evaluateHover(
     const EvaluateRequest& request) {
-  return evalWithEnv(request);
+  // Most hovers are a name or a field path, read without compiling them
+  const auto& expression = request.expression;
+  int level = static_cast<int>(request.frameId.value(0));
+  if (level >= 0 && level < static_cast<int>(stack_frames_.size()) &&
+      lua_utils::classify(expression) == lua_utils::CodeKind::IdentifierPath) {
+    const auto& frame = stack_frames_[level];
+    lua_utils::StackGuard guard(frame.L_);
+    if (lua_utils::pushIdentifierPath(frame.thread_, frame.level_,
+                                      expression)) {
+      if (frame.thread_ != frame.L_)
+        lua_xmove(frame.thread_, frame.L_, 1);
+      return formatResults(frame.L_, 1, true);
+    }
+  }
+  return evalWithEnv(request, true);
 }
 
 ResponseOrError<EvaluateResponse> DebugBridge::evalWithEnv(
-    const EvaluateRequest& request) {
+    const EvaluateRequest& request,
+    bool preview) {
   int level = 0;
   if (request.frameId.has_value())
     level = request.frameId.value();
 
   DEBUGGER_ASSERT(level >= 0 && level < stack_frames_.size());
-  lua_State* L = stack_frames_[level].L_;
+  const auto& frame = stack_frames_[level];
+  lua_State* L = frame.L_;
 
-  if (!lua_utils::pushBreakEnv(L, level))
+  // Names are resolved in the thread running the frame, the code runs in the
+  // thread of the break
+  lua_utils::BreakEnv break_env(frame.thread_, frame.level_);
+  if (!break_env.push(L))
     return Error{"Failed to push break environment"};
 
-  auto ret = lua_utils::eval(L, request.expression, -1);
+  auto ret = lua_utils::eval(L, request.expression, -1, compile_cache_);
   if (!ret.has_value()) {
     auto error = lua_utils::type::toString(L, -1);
     lua_pop(L, 2);
     return Error{error};
   }
 
+  auto response = formatResults(L, *ret, preview);
+
+  // Pop results and the environment
+  lua_pop(L, *ret + 1);
+  return response;
+}
+
+EvaluateResponse DebugBridge::formatResults(lua_State* L,
+                                            int count,
+                                            bool preview) {
   EvaluateResponse response;
 
   std::string result;
-  for (int i = *ret; i >= 1; --i) {
+  for (int i = count; i >= 1; --i) {
     if (!response.type.has_value()) {
-      response.type = lua_utils::type::getTypeName(lua_type(L, -i));
+      response.type =
+          std::string(lua_utils::type::getTypeName(lua_type(L, -i)));
 
       if (lua_istable(L, -i) || lua_isuserdata(L, -i)) {
         auto scope = lua_istable(L, -i) ? Scope::createTable(L, -i)
                                         : Scope::createUserData(L, -i);
-        variable_registry_.registerVariables(scope, {});
-        response.variablesReference = scope.getKey();
+        response.variablesReference =
+            variable_registry_.registerScope(std::move(scope)).getKey();
       }
     }
 
-    result += lua_utils::type::toString(L, -i);
+    result += preview ? lua_utils::type::toPreview(
+                            L, -i, variable_registry_.formatLimits())
+                      : lua_utils::type::toString(L, -i);
     if (i != 1)
       result += "\n";
   }
 
-  // Pop result
-  if (*ret > 0)
-    lua_pop(L, *ret);
-
-  // Pop the environment
-  lua_pop(L, 1);
-
   response.result = result;
   return response;
 }
@@ -542,9 +758,12 @@ void DebugBridge::writeDebugConsole(std::string_view output,
   event.output = std::string{output};
 
   lua_Debug ar;
-  if (L != nullptr && lua_getinfo(L, 1, "sln", &ar)) {
+  if (L != nullptr && lua_getinfo(L, 1, "sl", &ar)) {
     event.line = ar.currentline;
-    event.source = dap::Source{.path = file_mapping_.normalize(ar.source)};
+    if (auto* file = findFile(L, 1))
+      event.source = dap::Source{.path = std::string(file->path())};
+    else if (FileMapping::isFileChunk(ar.source))
+      event.source = dap::Source{.path = file_mapping_.normalize(ar.source)};
   }
 
   session_->send(std::move(event));
@@ -574,20 +793,118 @@ bool DebugBridge::hitBreakPoint(lua_State* L) {
 }
 
 BreakPoint* DebugBridge::findBreakPoint(lua_State* L) {
+  auto* file = findFile(L, 0);
+  if (file == nullptr)
+    return nullptr;
+
   lua_Debug ar;
-  lua_getinfo(L, 0, "sl", &ar);
-  auto it = files_.find(file_mapping_.normalize(ar.source));
-  if (it == files_.end())
+  lua_getinfo(L, 0, "l", &ar);
+  return file->findBreakPoint(ar.currentline);
+}
+
+File* DebugBridge::findFile(lua_State* L, int level) {
+  Proto* proto = lua_utils::getProto(L, level);
+  if (proto == nullptr)
+    return nullptr;
+
+  auto it = sources_.find(proto->source);
+  if (it != sources_.end())
+    return it->second.file_;
+
+  // Chunks of `loadstring` have their code as source, they are never files
+  const char* source = getstr(proto->source);
+  if (!FileMapping::isFileChunk(source))
     return nullptr;
 
-  auto& file = it->second;
-  return file.findBreakPoint(ar.currentline);
+  // File chunk not announced by `onLuaFileLoaded`, normalized once. Its
+  // source is pinned by a ref, so that its address is not reused.
+  File* file = nullptr;
+  auto found = files_.find(file_mapping_.normalize(
+      std::string_view(source, proto->source->len)));
+  if (found != files_.end())
+    file = &found->second;
+
+  lua_State* main = lua_mainthread(L);
+  lua_checkstack(main, 1);
+  // The string is interned, this is the source of the proto
+  lua_pushlstring(main, source, proto->source->len);
+  int ref = lua_ref(main, -1);
+  lua_pop(main, 1);
+  sources_[proto->source] = SourceInfo{file, main, ref};
+  return file;
+}
+
+void DebugBridge::forgetUnknownSources() {
+  std::erase_if(sources_, [](const auto& source) {
+    if (source.second.file_ != nullptr)
+      return false;
+    unpinSource(source.second);
+    return true;
+  });
+}
+
+void DebugBridge::unpinSource(const SourceInfo& source) {
+  if (source.ref_ != LUA_NOREF)
+    lua_unref(source.L_, source.ref_);
+}
+
+std::optional<int> DebugBridge::updateVariables(int reference) {
+  std::optional<int> frame;
+  executeInMainThread([&] {
+    auto* registered = variable_registry_.findScope(reference);
+    if (registered == nullptr)
+      return;
+    frame = findOnlyFrame(variable_registry_.invalidate(*registered));
+  });
+  return frame;
 }
 
-void DebugBridge::updateVariables() {
+std::optional<int> DebugBridge::updateFrameVariables(int frameId) {
+  std::optional<int> frame;
   executeInMainThread([&] {
-    variable_registry_.update({vm_registry_.getAncestors(break_vm_)});
+    if (frameId < 0 || frameId >= static_cast<int>(stack_frames_.size())) {
+      variable_registry_.invalidate();
+      return;
+    }
+
+    // The statement may assign the locals and upvalues of the frame, globals
+    // and fields of any table. Tables are only fetched again when they are
+    // expanded, they do not widen the event.
+    const auto& info = stack_frames_[frameId];
+    std::vector<Scope> invalidated;
+    for (Scope scope :
+         {variable_registry_.getLocalScope(info.thread_, info.level_),
+          variable_registry_.getUpvalueScope(info.thread_, info.level_),
+          variable_registry_.getGlobalScope(break_vm_)}) {
+      auto scopes = variable_registry_.invalidate(scope);
+      invalidated.insert(invalidated.end(), scopes.begin(), scopes.end());
+    }
+    variable_registry_.invalidateTables();
+    frame = findOnlyFrame(invalidated);
+    if (!frame.has_value() && invalidated.empty())
+      frame = frameId;
   });
+  return frame;
+}
+
+std::optional<int> DebugBridge::findOnlyFrame(
+    const std::vector<Scope>& scopes) const {
+  std::optional<int> frame;
+  for (const auto& scope : scopes) {
+    // Tables and globals can be listed under any frame
+    auto it = std::find_if(
+        stack_frames_.begin(), stack_frames_.end(),
+        [&scope](const StackFrameInfo& info) {
+          return (scope.isLocal() || scope.isUpvalue()) &&
+                 info.thread_ == scope.getLuaState() &&
+                 info.level_ == scope.getLevel();
+        });
+    int id = static_cast<int>(it - stack_frames_.begin());
+    if (it == stack_frames_.end() || (frame.has_value() && *frame != id))
+      return std::nullopt;
+    frame = id;
+  }
+  return frame;
 }
 
 std::vector<StackFrame> DebugBridge::updateStackFrames(lua_State* L) {
@@ -602,12 +919,14 @@ std::vector<StackFrame> DebugBridge::updateStackFrames(lua_State* L) {
       StackFrame frame;
       frame.name = ar.name ? ar.name : "anonymous";
       frame.source = Source{};
-      if (ar.source)
+      if (auto* file = findFile(L, level))
+        frame.source->path = std::string(file->path());
+      else if (ar.source)
         frame.source->path = file_mapping_.normalize(ar.source);
       frame.line = ar.currentline;
       frame.id = stack_frames_.size();
       frames.emplace_back(std::move(frame));
-      stack_frames_.emplace_back(StackFrameInfo{src, depth});
+      stack_frames_.emplace_back(StackFrameInfo{src, depth, L, level});
       ++depth;
     }
     L = vm_registry_.getParent(L);
@@ -620,7 +939,7 @@ void DebugBridge::mainThreadWait(lua_State* L,
                                  std::unique_lock<std::mutex>& lock) {
   break_vm_ = L;
   resume_ = false;
-  variable_registry_.update({vm_registry_.getAncestors(break_vm_)});
+  variable_registry_.beginBreak(L);
   while (!resume_) {
     resume_cv_.wait(lock, [this] { return resume_ || main_fn_ != nullptr; });
 
@@ -628,10 +947,10 @@ void DebugBridge::mainThreadWait(lua_State* L,
     if (main_fn_ != nullptr) {
       main_fn_();
       main_fn_ = nullptr;
-      resume_cv_.notify_one();
+      resume_cv_.notify_all();
     }
   }
-  variable_registry_.clear();
+  variable_registry_.endBreak();
   stack_frames_.clear();
   break_vm_ = nullptr;
 }
@@ -641,9 +960,20 @@ void DebugBridge::executeInMainThread(std::function<void()> fn) {
 
   // Fill the main_fn_ and wait for it to be executed
   std::unique_lock<std::mutex> lock(break_mutex_);
+  resume_cv_.wait(lock, [this] { return main_fn_ == nullptr; });
   main_fn_ = std::move(fn);
-  resume_cv_.notify_one();
+  resume_cv_.notify_all();
+  resume_cv_.wait(lock, [this] { return main_fn_ == nullptr; });
+}
+
+void DebugBridge::postToMainThread(std::function<void()> fn) {
+  DEBUGGER_ASSERT(isDebugBreak());
+
+  // Wait for the previous function only, e.g. a posted expansion
+  std::unique_lock<std::mutex> lock(break_mutex_);
   resume_cv_.wait(lock, [this] { return main_fn_ == nullptr; });
+  main_fn_ = std::move(fn);
+  resume_cv_.notify_all();
 }
 
 }  // namespace luau::debugger
\ No newline at end of file
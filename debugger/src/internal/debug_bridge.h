@@ -16,9 +16,11 @@
 #include <dap/session.h>
 
 #include <internal/breakpoint.h>
+#include <internal/compile_cache.h>
 #include <internal/file.h>
 #include <internal/file_mapping.h>
 #include <internal/lua_statics.h>
+#include <internal/step_traps.h>
 #include <internal/task_pool.h>
 #include <internal/variable.h>
 #include <internal/variable_registry.h>
@@ -26,8 +28,9 @@
 
 namespace luau::debugger {
 
+// Location of a break, cheap enough to be compared on every instruction
 struct BreakContext {
-  std::string source_;
+  const Proto* proto_ = nullptr;
   int line_ = 0;
   int depth_ = 0;
   lua_State* L_ = nullptr;
@@ -37,6 +40,9 @@ struct BreakContext {
 struct StackFrameInfo {
   lua_State* L_ = nullptr;
   int depth_ = 0;
+  // Thread running the frame and the level of the frame in it
+  lua_State* thread_ = nullptr;
+  int level_ = 0;
 };
 
 using namespace dap;
@@ -50,6 +56,19 @@ class DebugBridge final {
   void initialize(lua_State* L);
   void release(lua_State* L);
 
+  // In detached mode, hooks are installed when a client is connected and
+  // removed when disconnected
+  void setDetachedMode(bool enable) { detached_mode_ = enable; }
+
+  // Process tasks posted from DAP thread, called from **lua runtime** when
+  // it's idle, otherwise tasks are only processed on interrupts
+  void poll();
+
+  // Called from **DAP** thread after a task is posted
+  void setWakeUpHandler(std::function<void()> handler) {
+    interrupt_tasks_.setWakeUp(std::move(handler));
+  }
+
   FileMapping& fileMapping() { return file_mapping_; }
   bool isDebugBreak();
 
@@ -69,8 +88,11 @@ class DebugBridge final {
   void onDisconnect();
 
   // Called from **DAP** client when breakpoints changed in file
-  void setBreakPoints(std::string_view path,
-                      optional<array<SourceBreakpoint>> breakpoints);
+  // Conditions are compiled immediately, the breakpoints with invalid
+  // conditions are reported as unverified
+  array<Breakpoint> setBreakPoints(
+      std::string_view path,
+      optional<array<SourceBreakpoint>> breakpoints);
 
   // Called from **DAP** client to resume execution
   void resume();
@@ -84,14 +106,39 @@ class DebugBridge final {
   // Called from **DAP** client to get scopes for a frame
   ScopesResponse getScopes(int frameId);
 
-  // Called from **DAP** client to get variable by variable reference
-  VariablesResponse getVariables(int reference);
+  // Called from **DAP** client to get variables by variable reference, table
+  // elements are paged with `start`, `count` and `filter`. The variables are
+  // listed in main thread, which calls `respond` without blocking DAP thread.
+  void getVariables(const VariablesRequest& request,
+                    std::function<void(VariablesResponse)> respond);
+
+  // Called from **DAP** client to stop the expansion of a value with
+  // `__iter` or `__getters` in progress, safe to call in different thread
+  void cancelExpansion() { variable_registry_.budget().cancel(); }
+
+  // Safe to call in different thread, the limits are owned by main thread
+  void setExpansionLimits(ExpansionBudget::Limits limits) {
+    interrupt_tasks_.post(
+        [this, limits] { variable_registry_.budget().setLimits(limits); });
+  }
+
+  // Safe to call in different thread, the limits are owned by main thread
+  void setFormatLimits(lua_utils::type::FormatLimits limits) {
+    interrupt_tasks_.post(
+        [this, limits] { variable_registry_.setFormatLimits(limits); });
+  }
 
   // Called from **DAP** client to set variable value
   ResponseOrError<SetVariableResponse> setVariable(
       const SetVariableRequest& request);
 
-  void updateVariables();
+  // Refresh the variables that a change in the scope `reference` could
+  // touch. Return the only frame affected, or nullopt if it may be any frame.
+  std::optional<int> updateVariables(int reference);
+
+  // Refresh the variables that a statement run at frame `frameId` could
+  // touch. Return the only frame affected, or nullopt if it may be any frame.
+  std::optional<int> updateFrameVariables(int frameId);
 
   // Called from **DAP** client to step to next line
   void stepOver();
@@ -109,14 +156,28 @@ class DebugBridge final {
 
   VMRegistry& vms() { return vm_registry_; }
 
+  // Safe to call in different thread, the cache is owned by main thread
+  void setEvalCacheCapacity(std::size_t bytes) {
+    interrupt_tasks_.post([this, bytes] { compile_cache_.setCapacity(bytes); });
+  }
+
+  // Bytecode of watch, hover and repl expressions, its counters can be read
+  // from any thread
+  const CompileCache& compileCache() const { return compile_cache_; }
+
   dap::array<dap::Thread> getThreads();
 
  private:
   void initializeCallbacks(lua_State* L);
 
+  // Install callbacks and replace global functions
+  void installHooks(lua_State* L);
+  void uninstallHooks(lua_State* L);
+
   bool isBreakOnEntry(lua_State* L);
 
-  BreakContext getBreakContext(lua_State* L) const;
+  // L should be the running thread, `ar` is used if provided by a hook
+  BreakContext getBreakContext(lua_State* L, lua_Debug* ar = nullptr) const;
   int getStackDepth(lua_State* L) const;
 
   std::string stopReasonToString(BreakReason reason) const;
@@ -128,8 +189,16 @@ class DebugBridge final {
   // Return true if execution should be stopped, return false if execution
   // should continue
   using SingleStepProcessor = std::function<bool(lua_State*, lua_Debug* ar)>;
-  void processSingleStep(SingleStepProcessor processor);
-  void enableDebugStep(bool enable);
+
+  // Step over and step out only stop in the functions already running, which
+  // are trapped with line breakpoints, so the processor is only called on
+  // trapped lines and callees run at full speed. Step in may stop anywhere,
+  // it falls back to single step mode.
+  enum class StepKind { In, Over, Out };
+  void processSingleStep(SingleStepProcessor processor,
+                         StepKind kind = StepKind::In);
+  void enableDebugStep(bool enable, StepKind kind);
+  void trapActiveFrames(lua_State* L, bool skip_current);
 
   void resumeInternal();
 
@@ -140,15 +209,32 @@ class DebugBridge final {
   ResponseOrError<EvaluateResponse> evaluateHover(
       const EvaluateRequest& request);
 
-  ResponseOrError<EvaluateResponse> evalWithEnv(const EvaluateRequest& request);
+  // Values are bounded by the format limits if `preview` is true, otherwise
+  // they are formatted in full, e.g. for the debug console and the clipboard
+  ResponseOrError<EvaluateResponse> evalWithEnv(const EvaluateRequest& request,
+                                                bool preview);
+  // Response of the `count` values on the top of the stack, left there
+  EvaluateResponse formatResults(lua_State* L, int count, bool preview);
 
   bool hitBreakPoint(lua_State* L);
   BreakPoint* findBreakPoint(lua_State* L);
 
+  // Find the loaded file of the function running at `level`, no allocation
+  // and no path normalization involved once the source is known
+  File* findFile(lua_State* L, int level);
+  // Sources which matched no file may match the file just added
+  void forgetUnknownSources();
+  struct SourceInfo;
+  static void unpinSource(const SourceInfo& source);
+  // Only frame of the local and upvalue scopes, nullopt if there are others
+  std::optional<int> findOnlyFrame(const std::vector<Scope>& scopes) const;
+
   std::vector<StackFrame> updateStackFrames(lua_State* L);
 
   void mainThreadWait(lua_State* L, std::unique_lock<std::mutex>& lock);
   void executeInMainThread(std::function<void()> fn);
+  // Same without waiting for `fn` to be executed
+  void postToMainThread(std::function<void()> fn);
 
  private:
   friend class LuaStatics;
@@ -158,8 +244,24 @@ class DebugBridge final {
 
   bool stop_on_entry_ = false;
 
+  bool detached_mode_ = false;
+  // Whether hooks are installed in detached mode, only accessed in main thread
+  bool attached_ = false;
+
   std::unordered_map<std::string, File> files_;
 
+  // Interned source of loaded chunks -> loaded file, filled when file is
+  // loaded. The source string is kept alive by the file reference. Other
+  // file chunks are added on first lookup, pinned by `ref_`, with a null
+  // file if none matches.
+  struct SourceInfo {
+    File* file_ = nullptr;
+    lua_State* L_ = nullptr;
+    int ref_ = LUA_NOREF;
+  };
+  std::unordered_map<const TString*, SourceInfo> sources_;
+  File* entry_file_ = nullptr;
+
   lua_State* break_vm_ = nullptr;
   std::mutex break_mutex_;
   std::function<void()> main_fn_;
@@ -172,9 +274,13 @@ class DebugBridge final {
   std::condition_variable session_cv_;
 
   VariableRegistry variable_registry_;
+  CompileCache compile_cache_;
   TaskPool interrupt_tasks_;
 
   SingleStepProcessor single_step_processor_ = nullptr;
+  StepTraps step_traps_;
+  // Trap lua functions called from functions already running when stepping in
+  bool trap_callee_ = false;
 
   std::atomic<bool> should_pause_ = false;
 };
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+namespace luau::debugger {
+
+// Bounds the fields listed when a value is expanded with lua code, i.e. user
+// `__iter` and `__getters`, which may never end. The number of entries is
+// checked by the listing loop, the time and the cancellation are also checked
+// by the interrupt callback, which stops the lua code with an error.
+class ExpansionBudget {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Limits {
+    std::size_t entries_ = 1000;
+    std::chrono::milliseconds time_{500};
+  };
+
+  enum class Status { Ok, EntryLimit, Timeout, Cancelled };
+
+  // Started and stopped in main thread around one expansion
+  class Guard {
+   public:
+    explicit Guard(ExpansionBudget& budget) : budget_(budget) {
+      budget_.start();
+    }
+    ~Guard() { budget_.active_.store(false, std::memory_order_relaxed); }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    ExpansionBudget& budget_;
+  };
+
+  void setLimits(Limits limits) { limits_ = limits; }
+  const Limits& limits() const { return limits_; }
+
+  // Count one more entry, return false if it should not be listed
+  bool consume() {
+    if (check() != Status::Ok)
+      return false;
+    if (entries_ >= limits_.entries_) {
+      status_ = Status::EntryLimit;
+      return false;
+    }
+    ++entries_;
+    return true;
+  }
+
+  // Called from interrupts, true if the running expansion should be stopped
+  bool isExhausted() {
+    if (!active_.load(std::memory_order_relaxed))
+      return false;
+    return check() != Status::Ok;
+  }
+
+  // Called from **DAP** thread, stop the running expansion
+  void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // Why the last expansion was stopped, `Ok` if it listed all entries
+  Status status() const { return status_; }
+
+ private:
+  void start() {
+    entries_ = 0;
+    status_ = Status::Ok;
+    deadline_ = Clock::now() + limits_.time_;
+    cancelled_.store(false, std::memory_order_relaxed);
+    active_.store(true, std::memory_order_relaxed);
+  }
+
+  Status check() {
+    if (status_ != Status::Ok)
+      return status_;
+    if (cancelled_.load(std::memory_order_relaxed))
+      status_ = Status::Cancelled;
+    else if (Clock::now() >= deadline_)
+      status_ = Status::Timeout;
+    return status_;
+  }
+
+ private:
+  Limits limits_;
+  std::size_t entries_ = 0;
+  Status status_ = Status::Ok;
+  Clock::time_point deadline_;
+  std::atomic<bool> active_ = false;
+  std::atomic<bool> cancelled_ = false;
+};
+
+}  // namespace luau::debugger
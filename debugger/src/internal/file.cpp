@@ -17,11 +17,11 @@ LuaFileRef::LuaFileRef(lua_State* L) {
 
   // Save the lua_State associated with file
   lua_pushthread(L);
-  thread_ref_ = lua_ref(L, -1);
+  thread_ref_ = lua_utils::ref(L, -1);
   lua_pop(L, 1);
 
   // Save the function return by luau_load
-  file_ref_ = lua_ref(L, -1);
+  file_ref_ = lua_utils::ref(L, -1);
 }
 
 LuaFileRef::~LuaFileRef() {
@@ -36,6 +36,7 @@ LuaFileRef& LuaFileRef::operator=(const LuaFileRef& other) {
   if (this == &other)
     return *this;
 
+  release();
   copyFrom(other);
   return *this;
 }
@@ -45,11 +46,10 @@ bool LuaFileRef::operator==(const LuaFileRef& other) const {
 }
 
 void LuaFileRef::release() {
-  if (thread_ref_ != LUA_REFNIL)
-    lua_unref(L_, file_ref_);
-
-  if (file_ref_ != LUA_REFNIL)
-    lua_unref(L_, thread_ref_);
+  lua_utils::unref(L_, file_ref_);
+  lua_utils::unref(L_, thread_ref_);
+  file_ref_ = LUA_REFNIL;
+  thread_ref_ = LUA_REFNIL;
 }
 
 void LuaFileRef::copyFrom(const LuaFileRef& other) {
@@ -58,12 +58,12 @@ void LuaFileRef::copyFrom(const LuaFileRef& other) {
 
   // Copy the lua_State reference
   lua_getref(L_, other.thread_ref_);
-  thread_ref_ = lua_ref(L_, -1);
+  thread_ref_ = lua_utils::ref(L_, -1);
   lua_pop(L_, 1);
 
   // Copy the function reference
   lua_getref(L_, other.file_ref_);
-  file_ref_ = lua_ref(L_, -1);
+  file_ref_ = lua_utils::ref(L_, -1);
   func_ = lua_utils::getLuaFunction(L_, -1);
   lua_pop(L_, 1);
 }
@@ -98,6 +98,9 @@ void File::addRef(LuaFileRef ref) {
 }
 
 void File::removeRef(lua_State* L) {
+  for (auto& [_, bp] : breakpoints_)
+    bp.release(L);
+
   auto it = std::remove_if(
       refs_.begin(), refs_.end(),
       [L](const LuaFileRef& ref) { return lua_mainthread(ref.L_) == L; });
@@ -133,6 +136,11 @@ void File::clearBreakPoints() {
   breakpoints_.clear();
 }
 
+void File::enableBreakPoints() {
+  for (auto& [_, bp] : breakpoints_)
+    enableBreakPoint(bp, true);
+}
+
 BreakPoint* File::findBreakPoint(int line) {
   auto it = breakpoints_.find(line);
   if (it == breakpoints_.end())
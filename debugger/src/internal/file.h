@@ -42,6 +42,9 @@ class File {
   void addBreakPoint(int line);
   void clearBreakPoints();
 
+  // Enable all breakpoints again, e.g. after the lines are patched by others
+  void enableBreakPoints();
+
   template <class Predicate>
   void removeBreakPointsIf(Predicate pred);
 
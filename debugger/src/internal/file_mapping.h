@@ -19,6 +19,12 @@ class FileMapping {
     return entry_path_ == normalize(path);
   }
 
+  // Chunk names with '@' or '=' prefix are file paths, otherwise they are
+  // the source code itself, e.g. chunks loaded by `loadstring`
+  static bool isFileChunk(std::string_view source) {
+    return !source.empty() && (source[0] == '@' || source[0] == '=');
+  }
+
   std::string normalize(std::string_view path) const {
     if (path.empty())
       return std::string{};
@@ -43,6 +43,17 @@ void LuaStatics::debugbreak(lua_State* L, lua_Debug* ar) {
   auto bridge = DebugBridge::get(L);
   if (bridge == nullptr)
     return;
+
+  // Step traps share the break instruction with breakpoints
+  if (bridge->single_step_processor_ != nullptr) {
+    if ((bridge->single_step_processor_)(L, ar)) {
+      bridge->onDebugBreak(L, ar, DebugBridge::BreakReason::Step);
+      return;
+    }
+    if (bridge->findBreakPoint(L) == nullptr)
+      return;
+  }
+
   bridge->onDebugBreak(L, ar,
                        bridge->isBreakOnEntry(L)
                            ? DebugBridge::BreakReason::Entry
@@ -53,6 +64,12 @@ void LuaStatics::interrupt(lua_State* L, int gc) {
   auto bridge = DebugBridge::get(L);
   if (bridge == nullptr)
     return;
+
+  // Stop the lua code expanding a value in a debug break once its budget is
+  // exhausted, errors can't be raised from GC steps
+  if (gc < 0 && bridge->variable_registry_.budget().isExhausted())
+    luaL_error(L, "expansion stopped by the debugger");
+
   bridge->interruptUpdate(L);
 };
 
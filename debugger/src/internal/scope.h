@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <string_view>
 #include <type_traits>
@@ -8,7 +9,7 @@
 #include <lstate.h>
 #include <lua.h>
 
-#include <internal/utils/dap_utils.h>
+#include <internal/utils/lua_utils.h>
 
 namespace luau::debugger {
 
@@ -24,41 +25,17 @@ enum class ScopeType {
 class Scope final {
  public:
   Scope() = default;
-  Scope(const Scope& other) {
-    L_ = other.L_;
-    key_ = other.key_;
-    name_ = other.name_;
-    type_ = other.type_;
-    loaded_ = other.loaded_;
-    level_ = other.level_;
-
-    newRef(other.ref_);
-  }
-  Scope(Scope&& other) {
-    L_ = other.L_;
-    key_ = other.key_;
-    name_ = std::move(other.name_);
-    type_ = other.type_;
-    loaded_ = other.loaded_;
-    level_ = other.level_;
-
-    newRef(other.ref_);
-  }
-  ~Scope() {
-    if (ref_ != LUA_REFNIL && L_ != nullptr)
-      lua_unref(L_, ref_);
-  }
 
-  static Scope createLocal(std::string_view name) {
-    return createWithType(name, ScopeType::Local);
+  static Scope createLocal(std::string_view name, lua_State* L, int level) {
+    return createWithType(name, ScopeType::Local, L, level);
   }
 
-  static Scope createUpvalue(std::string_view name) {
-    return createWithType(name, ScopeType::UpValue);
+  static Scope createUpvalue(std::string_view name, lua_State* L, int level) {
+    return createWithType(name, ScopeType::UpValue, L, level);
   }
 
-  static Scope createGlobal(std::string_view name) {
-    return createWithType(name, ScopeType::Global);
+  static Scope createGlobal(std::string_view name, lua_State* L) {
+    return createWithType(name, ScopeType::Global, L, 0);
   }
 
   static Scope createTable(lua_State* L, int index = -1) {
@@ -80,49 +57,51 @@ class Scope final {
   explicit Scope(int key) : key_(key) { type_ = ScopeType::Unknown; }
 
   bool operator==(const Scope& other) const { return key_ == other.key_; }
-  Scope& operator=(const Scope& other) {
-    L_ = other.L_;
-    key_ = other.key_;
-    name_ = other.name_;
-    type_ = other.type_;
-    newRef(other.ref_);
-    return *this;
-  }
 
+  // Reference of the scope, assigned by the registry when it's registered
   int getKey() const { return key_; }
+  ScopeType getType() const { return type_; }
+  // Table or userdata listed by the scope
+  const void* getAddress() const { return address_; }
   std::string_view getName() const { return name_; }
   void setName(std::string name) { name_ = std::move(name); }
+  // Expression to evaluate the scope object, empty if unknown
+  std::string_view getEvaluateName() const { return evaluate_name_; }
+  void setEvaluateName(std::string name) { evaluate_name_ = std::move(name); }
   int getLevel() const { return level_; }
   void setLevel(int level) { level_ = level; }
   lua_State* getLuaState() const { return L_; }
+  // Scopes kept across breaks are moved to the thread of the current break
+  void setLuaState(lua_State* L) { L_ = L; }
 
   bool isLocal() const { return type_ == ScopeType::Local; }
   bool isUpvalue() const { return type_ == ScopeType::UpValue; }
+  bool isGlobal() const { return type_ == ScopeType::Global; }
   bool isTable() const { return type_ == ScopeType::Table; }
   bool isUserData() const { return type_ == ScopeType::UserData; }
-  bool isLoaded() const {
-    if (!isTable() && !isUserData())
-      return true;
-    return loaded_;
-  }
+  bool isLoaded() const { return loaded_; }
   bool markLoaded() const { return loaded_ = true; }
   bool markUnloaded() const { return loaded_ = false; }
 
   bool pushRef() const {
-    if (ref_ == LUA_REFNIL || L_ == nullptr)
+    if (ref_ == nullptr)
       return false;
 
     lua_checkstack(L_, 1);
-    lua_getref(L_, ref_);
+    lua_getref(L_, ref_->ref_);
     return true;
   }
 
  private:
-  static Scope createWithType(std::string_view name, ScopeType type) {
+  static Scope createWithType(std::string_view name,
+                              ScopeType type,
+                              lua_State* L,
+                              int level) {
     Scope scope;
-    scope.createKey(std::hash<std::string_view>{}(name));
     scope.type_ = type;
     scope.name_ = name;
+    scope.L_ = L;
+    scope.level_ = level;
     return scope;
   }
 
@@ -130,38 +109,37 @@ class Scope final {
   static Scope createFromAddress(lua_State* L, int index, const T* address) {
     Scope scope;
     scope.L_ = L;
-    scope.createKey(std::hash<const T*>{}(address));
-    scope.ref_ = lua_ref(L, index);
+    scope.address_ = address;
+    scope.ref_ = std::make_shared<const Ref>(L, index);
     return scope;
   }
 
-  void createKey(std::size_t hash) { key_ = dap_utils::clamp(hash); }
+  // Registry reference shared by the copies of a scope
+  struct Ref {
+    // Released with the main thread, the thread of the scope may be collected
+    // before the last copy
+    Ref(lua_State* L, int index)
+        : L_(lua_mainthread(L)), ref_(lua_utils::ref(L, index)) {}
+    ~Ref() { lua_utils::unref(L_, ref_); }
+    Ref(const Ref&) = delete;
+    Ref& operator=(const Ref&) = delete;
 
-  void newRef(int ref) {
-    if (ref == LUA_REFNIL)
-      return;
-
-    lua_checkstack(L_, 1);
-    lua_getref(L_, ref);
-    ref_ = lua_ref(L_, -1);
-    lua_pop(L_, 1);
-  }
+    lua_State* L_;
+    int ref_;
+  };
 
  private:
+  friend class VariableRegistry;
+
   int key_ = 0;
   std::string name_;
+  std::string evaluate_name_;
   ScopeType type_ = ScopeType::Local;
   lua_State* L_ = nullptr;
-  int ref_ = LUA_REFNIL;
+  const void* address_ = nullptr;
+  std::shared_ptr<const Ref> ref_;
   mutable bool loaded_ = false;
   int level_ = 0;
 };
 
 }  // namespace luau::debugger
-
-template <>
-struct std::hash<luau::debugger::Scope> {
-  std::size_t operator()(const luau::debugger::Scope& scope) const {
-    return std::hash<int>{}(scope.getKey());
-  }
-};
\ No newline at end of file
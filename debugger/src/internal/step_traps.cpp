@@ -0,0 +1,82 @@
+#include <algorithm>
+
+#include <ldebug.h>
+#include <lobject.h>
+#include <lua.h>
+
+#include <internal/utils/lua_utils.h>
+
+#include "step_traps.h"
+
+namespace luau::debugger {
+
+void StepTraps::trapFunction(lua_State* L, int index) {
+  auto* func = lua_utils::getLuaFunction(L, index);
+  if (func == nullptr)
+    return;
+
+  const Proto* proto = func->l.p;
+  if (isTrapped(proto))
+    return;
+
+  Trap trap{.L_ = lua_mainthread(L), .lines_ = getLines(proto)};
+  int func_index = lua_absindex(L, index);
+  for (int line : trap.lines_)
+    lua_breakpoint(L, func_index, line, true);
+
+  // Keep the function alive until the traps are removed
+  trap.ref_ = lua_utils::ref(L, func_index);
+  traps_.emplace(proto, std::move(trap));
+}
+
+void StepTraps::trapFrame(lua_State* L, int level) {
+  lua_Debug ar;
+  lua_checkstack(L, 1);
+  if (!lua_getinfo(L, level, "f", &ar))
+    return;
+  trapFunction(L, -1);
+  lua_pop(L, 1);
+}
+
+bool StepTraps::isTrapped(const Proto* proto) const {
+  return traps_.find(proto) != traps_.end();
+}
+
+void StepTraps::clear() {
+  for (auto& [_, trap] : traps_) {
+    lua_State* L = trap.L_;
+    lua_checkstack(L, 1);
+    lua_getref(L, trap.ref_);
+    for (int line : trap.lines_)
+      lua_breakpoint(L, -1, line, false);
+    lua_pop(L, 1);
+    lua_utils::unref(L, trap.ref_);
+  }
+  traps_.clear();
+}
+
+void StepTraps::release(lua_State* L) {
+  std::erase_if(traps_, [L](const auto& trap) {
+    if (trap.second.L_ != L)
+      return false;
+    lua_utils::unref(L, trap.second.ref_);
+    return true;
+  });
+}
+
+std::vector<int> StepTraps::getLines(const Proto* proto) {
+  std::vector<int> lines;
+  if (proto->lineinfo == nullptr)
+    return lines;
+
+  for (int pc = 0; pc < proto->sizecode; ++pc) {
+    int line = luaG_getline(const_cast<Proto*>(proto), pc);
+    if (lines.empty() || lines.back() != line)
+      lines.push_back(line);
+  }
+  std::sort(lines.begin(), lines.end());
+  lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+  return lines;
+}
+
+}  // namespace luau::debugger
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <lobject.h>
+#include <lua.h>
+
+namespace luau::debugger {
+
+// Temporary breakpoints on every line of a function, used while stepping.
+// Luau only samples the single step flag when entering the interpreter loop,
+// so functions already running when a step starts never reach `debugstep`,
+// they are trapped with line breakpoints instead.
+class StepTraps {
+ public:
+  // Trap all lines of the lua function at `index`
+  void trapFunction(lua_State* L, int index);
+
+  // Trap all lines of the lua function running at `level`
+  void trapFrame(lua_State* L, int level);
+
+  bool isTrapped(const Proto* proto) const;
+  bool empty() const { return traps_.empty(); }
+
+  // Remove all traps, breakpoints sharing the trapped lines are disabled too
+  // and should be enabled again by the caller
+  void clear();
+
+  // Drop the traps of the lua VM without touching the functions
+  void release(lua_State* L);
+
+ private:
+  struct Trap {
+    lua_State* L_ = nullptr;
+    int ref_ = LUA_REFNIL;
+    std::vector<int> lines_;
+  };
+  static std::vector<int> getLines(const Proto* proto);
+
+ private:
+  std::unordered_map<const Proto*, Trap> traps_;
+};
+
+}  // namespace luau::debugger
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <unordered_set>
+
+namespace luau::debugger {
+
+// Bump allocator for the data of one debug break, or of a cache which is
+// rebuilt as a whole. Nothing allocated in it is destroyed: objects stored in
+// it must be trivially destructible, and all the memory is released at once by
+// `reset`, e.g. when the break ends.
+class StopArena {
+ public:
+  static constexpr std::size_t kInitialSize = 64 * 1024;
+
+  StopArena() : resource_(kInitialSize) {}
+  StopArena(const StopArena&) = delete;
+  StopArena& operator=(const StopArena&) = delete;
+
+  std::pmr::memory_resource* resource() { return &resource_; }
+
+  // Incremented by `reset`, views from previous epochs are dangling
+  unsigned epoch() const { return epoch_; }
+
+  // Copy of `str` in the arena, null terminated so that it can be passed to
+  // lua API directly
+  std::string_view copy(std::string_view str) {
+    auto* data =
+        static_cast<char*>(resource_.allocate(str.size() + 1, alignof(char)));
+    std::memcpy(data, str.data(), str.size());
+    data[str.size()] = '\0';
+    return {data, str.size()};
+  }
+
+  // Same as `copy`, but equal names share one copy, e.g. locals with the same
+  // name in different frames
+  std::string_view intern(std::string_view name) {
+    if (names_ == nullptr)
+      names_ = new (resource_.allocate(sizeof(Names), alignof(Names)))
+          Names(&resource_);
+
+    auto it = names_->find(name);
+    if (it != names_->end())
+      return *it;
+    return *names_->insert(copy(name)).first;
+  }
+
+  // The interned set lives in the arena and holds views only, it's dropped
+  // with the rest of the memory without walking its nodes.
+  void reset() {
+    names_ = nullptr;
+    resource_.release();
+    ++epoch_;
+  }
+
+ private:
+  using Names = std::pmr::unordered_set<std::string_view>;
+
+  std::pmr::monotonic_buffer_resource resource_;
+  Names* names_ = nullptr;
+  unsigned epoch_ = 0;
+};
+
+}  // namespace luau::debugger
@@ -1,31 +1,105 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <thread>
 
+#include <internal/log.h>
+
 namespace luau::debugger {
+
+// Bounded lock-free multi-producer single-consumer task queue. Tasks are
+// posted from DAP thread and processed in the main thread, either from the
+// interrupt callback or from `Debugger::poll`. Tasks posted while the queue is
+// full are spilled to a locked list instead of being dropped.
 class TaskPool {
  public:
   using Task = std::function<void()>;
-  TaskPool(std::thread::id main_thread_id) : main_thread_id_(main_thread_id) {}
+  using WakeUp = std::function<void()>;
+  static constexpr std::size_t kCapacity = 1024;
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "capacity should be power of 2");
+
+  TaskPool(std::thread::id main_thread_id) : main_thread_id_(main_thread_id) {
+    for (std::size_t i = 0; i < kCapacity; ++i)
+      nodes_[i].sequence_.store(i, std::memory_order_relaxed);
+  }
+
   void post(Task task) {
     if (isMainThread()) {
       task();
       return;
     }
-    std::scoped_lock lock(mutex_);
-    tasks_.push_back(std::move(task));
+
+    // Keep the order once tasks are spilled, until the spill is processed
+    if (spilled_.load(std::memory_order_acquire) || !tryEnqueue(task))
+      spill(std::move(task));
+    signal();
   }
 
+  // Mark the pool as pending without posting a task, e.g. pause request
+  void signal(bool wake_up = true) {
+    // Pairs with the fence of `process`, either the task is seen there or the
+    // pool is left pending
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    pending_.store(true, std::memory_order_relaxed);
+    if (!wake_up)
+      return;
+    std::scoped_lock lock(wake_up_mutex_);
+    if (wake_up_ != nullptr)
+      wake_up_();
+  }
+
+  // Cheap enough to be checked on every interrupt
+  bool isPending() const { return pending_.load(std::memory_order_relaxed); }
+
+  // Called from the producer side when a task is posted, so the host can
+  // process tasks when the lua runtime is idle. Can be set from any thread,
+  // `wake_up` is called under a lock and should not set it again.
+  void setWakeUp(WakeUp wake_up) {
+    std::scoped_lock lock(wake_up_mutex_);
+    wake_up_ = std::move(wake_up);
+  }
+
+  // Should only be called from main thread
   void process() {
-    std::vector<Task> tasks;
-    {
-      std::scoped_lock lock(mutex_);
-      std::swap(tasks_, tasks);
+    // Tasks posted from now on will mark the pool as pending again
+    pending_.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    while (true) {
+      Node* node = &nodes_[dequeue_pos_ & (kCapacity - 1)];
+      std::size_t sequence = node->sequence_.load(std::memory_order_acquire);
+      if (static_cast<std::intptr_t>(sequence) -
+              static_cast<std::intptr_t>(dequeue_pos_ + 1) <
+          0)
+        break;
+
+      Task task = std::move(node->task_);
+      node->task_ = nullptr;
+      node->sequence_.store(dequeue_pos_ + kCapacity,
+                            std::memory_order_release);
+      ++dequeue_pos_;
+
+      task();
     }
 
-    for (const auto& task : tasks)
+    if (!spilled_.load(std::memory_order_acquire))
+      return;
+
+    // Posted after the tasks of the queue, new tasks go to the queue again
+    std::deque<Task> tasks;
+    {
+      std::scoped_lock lock(spill_mutex_);
+      tasks.swap(spill_);
+      spilled_.store(false, std::memory_order_release);
+    }
+    for (auto& task : tasks)
       task();
   }
 
@@ -34,9 +108,54 @@ class TaskPool {
     return std::this_thread::get_id() == main_thread_id_;
   }
 
+  // Return false if the queue is full, `task` is left untouched
+  bool tryEnqueue(Task& task) {
+    Node* node = nullptr;
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      node = &nodes_[pos & (kCapacity - 1)];
+      std::size_t sequence = node->sequence_.load(std::memory_order_acquire);
+      auto diff = static_cast<std::intptr_t>(sequence) -
+                  static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+          break;
+      } else if (diff < 0)
+        return false;
+      else
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+
+    node->task_ = std::move(task);
+    node->sequence_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  void spill(Task task) {
+    std::scoped_lock lock(spill_mutex_);
+    if (!spilled_.load(std::memory_order_relaxed))
+      DEBUGGER_LOG_INFO("[TaskPool] queue is full, spilling tasks");
+    spill_.push_back(std::move(task));
+    spilled_.store(true, std::memory_order_release);
+  }
+
  private:
+  struct Node {
+    std::atomic<std::size_t> sequence_ = 0;
+    Task task_;
+  };
+
   std::thread::id main_thread_id_;
-  std::vector<Task> tasks_;
-  std::mutex mutex_;
+  std::array<Node, kCapacity> nodes_;
+  std::atomic<std::size_t> enqueue_pos_ = 0;
+  std::size_t dequeue_pos_ = 0;
+  std::atomic<bool> pending_ = false;
+  std::mutex wake_up_mutex_;
+  WakeUp wake_up_ = nullptr;
+
+  std::mutex spill_mutex_;
+  std::deque<Task> spill_;
+  std::atomic<bool> spilled_ = false;
 };
-}  // namespace luau::debugger
\ No newline at end of file
+}  // namespace luau::debugger
@@ -0,0 +1,242 @@
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <lapi.h>
+#include <ldebug.h>
+#include <lgc.h>
+#include <lobject.h>
+#include <lstate.h>
+#include <lua.h>
+
+#include <internal/utils/break_env.h>
+
+namespace luau::debugger::lua_utils {
+
+namespace {
+// Registry fields of the proxy and of its state, created once per VM
+constexpr const char* kProxyKey = "luau_debugger.break_env";
+constexpr const char* kStateKey = "luau_debugger.break_env_state";
+
+// Protos whose names are indexed, the index is rebuilt from scratch when it
+// grows over this
+constexpr std::size_t kMaxProtos = 1024;
+}  // namespace
+
+// Frame bound to the proxy and the names of the functions evaluated in, owned
+// by a userdata of the VM
+class BreakEnv::State {
+ public:
+  lua_State* thread_ = nullptr;
+  // Index of the frame from the base of `thread_`, frames of the evaluation
+  // itself are pushed above it, e.g. the chunk and the metamethods
+  int frame_ = -1;
+
+  // Local or upvalue of the bound frame named `name`
+  struct Slot {
+    enum class Kind { None, Local, Upvalue };
+    Kind kind_ = Kind::None;
+    // Register of locals, index of upvalues
+    int index_ = 0;
+  };
+
+  // Lua frame bound to the proxy, nullptr if it's gone or a C function
+  CallInfo* callInfo() const {
+    if (thread_ == nullptr || frame_ <= 0 ||
+        frame_ > thread_->ci - thread_->base_ci)
+      return nullptr;
+    CallInfo* ci = thread_->base_ci + frame_;
+    return isLua(ci) ? ci : nullptr;
+  }
+
+  Slot find(CallInfo* ci, const TString* name) {
+    Proto* p = clvalue(ci->func)->l.p;
+    const auto& names = namesOf(p);
+    int pc = pcRel(ci->savedpc, p);
+
+    // Later locals shadow the earlier ones with the same name
+    if (auto it = names.locals_.find(name); it != names.locals_.end()) {
+      for (auto i = it->second.rbegin(); i != it->second.rend(); ++i) {
+        const LocVar& var = p->locvars[*i];
+        if (var.varname == name && var.startpc <= pc && pc < var.endpc)
+          return {Slot::Kind::Local, var.reg};
+      }
+    }
+    if (auto it = names.upvalues_.find(name); it != names.upvalues_.end())
+      return {Slot::Kind::Upvalue, it->second};
+    return {};
+  }
+
+ private:
+  // Names of a proto by their interned strings, built once per proto
+  struct Names {
+    // Identity of the proto, its address may be reused once it's collected
+    const LocVar* locvars_ = nullptr;
+    TString* const* upvalue_names_ = nullptr;
+    const Instruction* code_ = nullptr;
+
+    // Indices in `locvars`, in declaration order
+    std::unordered_map<const TString*, std::vector<int>> locals_;
+    std::unordered_map<const TString*, int> upvalues_;
+
+    bool matches(const Proto* p) const {
+      return locvars_ == p->locvars && upvalue_names_ == p->upvalues &&
+             code_ == p->code;
+    }
+  };
+
+  const Names& namesOf(const Proto* p) {
+    if (auto it = names_.find(p); it != names_.end() && it->second.matches(p))
+      return it->second;
+
+    if (names_.size() >= kMaxProtos)
+      names_.clear();
+
+    auto& names = names_[p];
+    names = Names{};
+    names.locvars_ = p->locvars;
+    names.upvalue_names_ = p->upvalues;
+    names.code_ = p->code;
+    for (int i = 0; i < p->sizelocvars; ++i)
+      names.locals_[p->locvars[i].varname].push_back(i);
+    for (int i = 0; i < p->sizeupvalues; ++i) {
+      if (p->upvalues[i] != nullptr)
+        names.upvalues_.emplace(p->upvalues[i], i);
+    }
+    return names;
+  }
+
+  std::unordered_map<const Proto*, Names> names_;
+};
+
+namespace {
+using State = BreakEnv::State;
+
+State* getState(lua_State* L) {
+  return static_cast<State*>(lua_touserdata(L, lua_upvalueindex(1)));
+}
+
+// Environment of the function of the frame, the globals without frame
+void pushEnvironment(lua_State* L, CallInfo* ci) {
+  if (ci == nullptr) {
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    return;
+  }
+  luaA_pushobject(L, ci->func);
+  lua_getfenv(L, -1);
+  lua_remove(L, -2);
+}
+
+State::Slot findSlot(lua_State* L, State* state, CallInfo* ci) {
+  if (ci == nullptr || lua_type(L, 2) != LUA_TSTRING)
+    return {};
+  return state->find(ci, tsvalue(luaA_toobject(L, 2)));
+}
+
+// __index(proxy, key)
+int indexProxy(lua_State* L) {
+  auto* state = getState(L);
+  CallInfo* ci = state->callInfo();
+  auto slot = findSlot(L, state, ci);
+  switch (slot.kind_) {
+    case State::Slot::Kind::Local:
+      luaA_pushobject(L, ci->base + slot.index_);
+      return 1;
+    case State::Slot::Kind::Upvalue:
+      luaA_pushobject(L, ci->func);
+      lua_getupvalue(L, -1, slot.index_ + 1);
+      return 1;
+    case State::Slot::Kind::None:
+      break;
+  }
+
+  pushEnvironment(L, ci);
+  lua_pushvalue(L, 2);
+  lua_gettable(L, -2);
+  return 1;
+}
+
+// __newindex(proxy, key, value)
+int newIndexProxy(lua_State* L) {
+  auto* state = getState(L);
+  CallInfo* ci = state->callInfo();
+  auto slot = findSlot(L, state, ci);
+  switch (slot.kind_) {
+    case State::Slot::Kind::Local:
+      // The frame may belong to another thread than the evaluation
+      luaC_threadbarrier(state->thread_);
+      setobj2s(state->thread_, ci->base + slot.index_, luaA_toobject(L, 3));
+      return 0;
+    case State::Slot::Kind::Upvalue:
+      luaA_pushobject(L, ci->func);
+      lua_pushvalue(L, 3);
+      lua_setupvalue(L, -2, slot.index_ + 1);
+      return 0;
+    case State::Slot::Kind::None:
+      break;
+  }
+
+  pushEnvironment(L, ci);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 3);
+  lua_settable(L, -3);
+  return 0;
+}
+
+// Push the proxy of the VM, it's created on first use
+State* pushProxy(lua_State* L) {
+  lua_checkstack(L, 5);
+  lua_rawgetfield(L, LUA_REGISTRYINDEX, kStateKey);
+  if (auto* state = static_cast<State*>(lua_touserdata(L, -1))) {
+    lua_pop(L, 1);
+    lua_rawgetfield(L, LUA_REGISTRYINDEX, kProxyKey);
+    return state;
+  }
+  lua_pop(L, 1);
+
+  void* memory = lua_newuserdatadtor(L, sizeof(State), [](void* state) {
+    static_cast<State*>(state)->~State();
+  });
+  auto* state = new (memory) State();
+  int state_idx = lua_gettop(L);
+
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushvalue(L, state_idx);
+  lua_pushcclosure(L, indexProxy, "__index", 1);
+  lua_setfield(L, -2, "__index");
+  lua_pushvalue(L, state_idx);
+  lua_pushcclosure(L, newIndexProxy, "__newindex", 1);
+  lua_setfield(L, -2, "__newindex");
+  lua_setmetatable(L, -2);
+
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, kProxyKey);
+  lua_pushvalue(L, state_idx);
+  lua_setfield(L, LUA_REGISTRYINDEX, kStateKey);
+  lua_remove(L, state_idx);
+  return state;
+}
+}  // namespace
+
+BreakEnv::~BreakEnv() {
+  if (state_ == nullptr)
+    return;
+  state_->thread_ = previous_thread_;
+  state_->frame_ = previous_frame_;
+}
+
+bool BreakEnv::push(lua_State* L) {
+  lua_Debug ar = {};
+  if (state_ != nullptr || !lua_getinfo(thread_, level_, "", &ar))
+    return false;
+
+  state_ = pushProxy(L);
+  previous_thread_ = state_->thread_;
+  previous_frame_ = state_->frame_;
+  state_->thread_ = thread_;
+  state_->frame_ = static_cast<int>(thread_->ci - level_ - thread_->base_ci);
+  return true;
+}
+
+}  // namespace luau::debugger::lua_utils
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <lua.h>
+
+namespace luau::debugger::lua_utils {
+
+// Environment of code evaluated in a frame, e.g. watch expressions and
+// breakpoint conditions. It's a proxy table shared by all evaluations of a
+// VM, its names are resolved against the frame when they are accessed:
+// locals, then upvalues, then the environment of the function. Assignments
+// are written back to them, so that `x = 1` in the debug console changes the
+// local `x`.
+//
+// The frame is bound while the guard is alive, the frame of an enclosing
+// evaluation is restored on destruction, e.g. after a breakpoint condition
+// evaluated while the debug console runs a function.
+class BreakEnv {
+ public:
+  // Frame at `level` of `thread`
+  BreakEnv(lua_State* thread, int level) : thread_(thread), level_(level) {}
+  ~BreakEnv();
+  BreakEnv(const BreakEnv&) = delete;
+  BreakEnv& operator=(const BreakEnv&) = delete;
+
+  // Push the environment to the stack of `L`, the thread running the
+  // evaluation. The frame is located now, so that it's still found once the
+  // evaluation runs above it on the same thread. Return false if the frame
+  // does not exist.
+  bool push(lua_State* L);
+
+  class State;
+
+ private:
+  lua_State* thread_ = nullptr;
+  int level_ = 0;
+
+  State* state_ = nullptr;
+  lua_State* previous_thread_ = nullptr;
+  int previous_frame_ = -1;
+};
+
+}  // namespace luau::debugger::lua_utils
@@ -1,3 +1,5 @@
+#include <array>
+
 #include <lua.h>
 
 #include <internal/utils/lua_utils.h>
@@ -6,7 +8,28 @@
 
 namespace luau::debugger::lua_utils::type {
 
-std::string formatComplexData(lua_State* L, int index) {
+std::string truncate(std::string_view value,
+                     std::size_t limit,
+                     bool* truncated) {
+  if (value.size() <= limit)
+    return std::string(value);
+
+  // Do not split UTF-8 sequences
+  std::size_t length = limit;
+  while (length > 0 &&
+         (static_cast<unsigned char>(value[length]) & 0xC0) == 0x80)
+    --length;
+
+  if (truncated != nullptr)
+    *truncated = true;
+  return std::format("{}{} ({} bytes)", value.substr(0, length),
+                     kTruncatedMarker, value.size());
+}
+
+std::string formatComplexData(lua_State* L,
+                              int index,
+                              std::size_t limit,
+                              bool* truncated) {
   DisableDebugStep _(L);
   lua_checkstack(L, 1);
   const void* ptr = lua_topointer(L, index);
@@ -16,46 +39,77 @@ std::string formatComplexData(lua_State* L, int index) {
   auto result = std::format("{}", data);
   lua_pop(L, 1);
   if (lua_utils::callMetaProtected(L, index, "__tostring")) {
-    const char* s = lua_tolstring(L, -1, nullptr);
+    std::size_t length = 0;
+    const char* s = lua_tolstring(L, -1, &length);
     if (s != nullptr)
-      result = std::format("{} ({})", result, s);
+      result = std::format("{} ({})", result,
+                           truncate({s, length}, limit, truncated));
     lua_pop(L, 1);
   }
   return result;
 }
 
 using ToString = std::string (*)(lua_State*, int);
-using GetTypeName = std::string (*)();
+using GetTypeName = std::string_view (*)();
 struct Processor {
-  ToString toString_;
-  GetTypeName getTypeName_;
+  ToString toString_ = nullptr;
+  GetTypeName getTypeName_ = nullptr;
 };
-using TypeProcessors = std::unordered_map<lua_Type, Processor>;
+// Indexed by `lua_Type`, empty for types which are not registered
+using TypeProcessors = std::array<Processor, LUA_T_COUNT>;
 
 template <class T>
 class With;
 template <Type... T>
 class With<TypeList<T...>> {
  public:
-  static TypeProcessors createProcessors() {
-    return {{T::type, Processor{T::toString, T::typeName}}...};
+  static constexpr TypeProcessors createProcessors() {
+    static_assert(((T::type >= 0 && T::type < LUA_T_COUNT) && ...));
+    TypeProcessors processors{};
+    ((processors[T::type] = Processor{T::toString, T::typeName}), ...);
+    return processors;
   }
 };
 
-TypeProcessors& processors() {
-  static auto processors = With<RegisteredTypes>::createProcessors();
-  return processors;
+constexpr TypeProcessors kProcessors =
+    With<RegisteredTypes>::createProcessors();
+
+const Processor* findProcessor(int type) {
+  if (type < 0 || type >= LUA_T_COUNT)
+    return nullptr;
+  const auto& processor = kProcessors[type];
+  return processor.toString_ != nullptr ? &processor : nullptr;
 }
 
 std::string toString(lua_State* L, int index) {
-  lua_Type type = static_cast<lua_Type>(lua_type(L, index));
-  auto it = processors().find(type);
-  return it == processors().end() ? "unknown" : it->second.toString_(L, index);
+  auto* processor = findProcessor(lua_type(L, index));
+  return processor == nullptr ? "unknown" : processor->toString_(L, index);
+}
+
+std::string_view getTypeName(int type) {
+  auto* processor = findProcessor(type);
+  return processor == nullptr ? "unknown" : processor->getTypeName_();
 }
 
-std::string getTypeName(int type) {
-  auto it = processors().find(static_cast<lua_Type>(type));
-  return it == processors().end() ? "unknown" : it->second.getTypeName_();
+std::string toPreview(lua_State* L,
+                      int index,
+                      const FormatLimits& limits,
+                      bool* truncated) {
+  switch (lua_type(L, index)) {
+    case LUA_TSTRING: {
+      std::size_t length = 0;
+      const char* s = lua_tolstring(L, index, &length);
+      return truncate({s, length}, limits.string_, truncated);
+    }
+    case LUA_TLIGHTUSERDATA:
+    case LUA_TTABLE:
+    case LUA_TFUNCTION:
+    case LUA_TUSERDATA:
+    case LUA_TTHREAD:
+      return formatComplexData(L, index, limits.tostring_, truncated);
+    default:
+      return toString(L, index);
+  }
 }
 
 }  // namespace luau::debugger::lua_utils::type
\ No newline at end of file
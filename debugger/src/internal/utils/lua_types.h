@@ -1,6 +1,7 @@
 #pragma once
 #include <format>
 #include <string>
+#include <string_view>
 
 #include <lua.h>
 #include <lualib.h>
@@ -10,26 +11,43 @@ namespace luau::debugger::lua_utils::type {
 template <class T>
 concept Type = requires(T, lua_State* L, int index) {
   { T::type } -> std::convertible_to<lua_Type>;
-  { T::typeName() } -> std::convertible_to<std::string>;
+  { T::typeName() } -> std::same_as<std::string_view>;
   { T::toString(L, index) } -> std::same_as<std::string>;
 };
 
 template <Type... T>
 struct TypeList;
 
-std::string formatComplexData(lua_State* L, int index);
+// Previews of values are bounded, longer strings and `__tostring` results are
+// truncated and marked. The full value is only formatted on evaluation.
+struct FormatLimits {
+  std::size_t string_ = 1024;
+  std::size_t tostring_ = 256;
+};
+
+// Appended to truncated values, followed by the full size
+inline constexpr std::string_view kTruncatedMarker = "...";
+
+std::string truncate(std::string_view value,
+                     std::size_t limit,
+                     bool* truncated = nullptr);
+
+std::string formatComplexData(lua_State* L,
+                              int index,
+                              std::size_t limit = std::string::npos,
+                              bool* truncated = nullptr);
 
 class Nil {
  public:
   static constexpr lua_Type type = LUA_TNIL;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) { return "nil"; }
 };
 
 class Boolean {
  public:
   static constexpr lua_Type type = LUA_TBOOLEAN;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return lua_toboolean(L, index) ? "true" : "false";
   }
@@ -38,7 +56,7 @@ class Boolean {
 class Vector {
  public:
   static constexpr lua_Type type = LUA_TVECTOR;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     const float* v = lua_tovector(L, index);
     return std::format("({}, {}, {})", v[0], v[1], v[2]);
@@ -48,7 +66,7 @@ class Vector {
 class Number {
  public:
   static constexpr lua_Type type = LUA_TNUMBER;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     // NOTICE: make lua_tostring call to a copy of the value to avoid modify
     // the original value
@@ -63,7 +81,7 @@ class Number {
 class Integer {
  public:
   static constexpr lua_Type type = LUA_TINTEGER;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     int64_t value = lua_tointeger64(L, index, nullptr);
     return std::format("{}", value);
@@ -73,7 +91,7 @@ class Integer {
 class String {
  public:
   static constexpr lua_Type type = LUA_TSTRING;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return lua_tostring(L, index);
   }
@@ -82,7 +100,7 @@ class String {
 class LightUserData {
  public:
   static constexpr lua_Type type = LUA_TLIGHTUSERDATA;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return formatComplexData(L, index);
   }
@@ -91,7 +109,7 @@ class LightUserData {
 class Table {
  public:
   static constexpr lua_Type type = LUA_TTABLE;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return formatComplexData(L, index);
   }
@@ -100,7 +118,7 @@ class Table {
 class Function {
  public:
   static constexpr lua_Type type = LUA_TFUNCTION;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return formatComplexData(L, index);
   }
@@ -109,7 +127,7 @@ class Function {
 class UserData {
  public:
   static constexpr lua_Type type = LUA_TUSERDATA;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return formatComplexData(L, index);
   }
@@ -118,7 +136,7 @@ class UserData {
 class Thread {
  public:
   static constexpr lua_Type type = LUA_TTHREAD;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) {
     return formatComplexData(L, index);
   }
@@ -127,7 +145,7 @@ class Thread {
 class Buffer {
  public:
   static constexpr lua_Type type = LUA_TBUFFER;
-  static std::string typeName() { return lua_typename(nullptr, type); }
+  static std::string_view typeName() { return lua_typename(nullptr, type); }
   static std::string toString(lua_State* L, int index) { return "buffer"; }
 };
 
@@ -145,6 +163,14 @@ using RegisteredTypes = TypeList<Nil,
                                  Buffer>;
 
 std::string toString(lua_State* L, int index);
-std::string getTypeName(int type);
+// Names are static, no allocation is needed to format them
+std::string_view getTypeName(int type);
+
+// Bounded `toString` by `limits`, `truncated` is set if the value is
+// truncated
+std::string toPreview(lua_State* L,
+                      int index,
+                      const FormatLimits& limits,
+                      bool* truncated = nullptr);
 
 }  // namespace luau::debugger::lua_utils::type
\ No newline at end of file
@@ -1,116 +1,430 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <format>
 #include <optional>
 #include <ranges>
 
+#include <Luau/Bytecode.h>
+#include <Luau/Lexer.h>
+#include <Luau/Parser.h>
 #include <lapi.h>
 #include <lobject.h>
 #include <lstate.h>
+#include <ltable.h>
 #include <lua.h>
 
+#include <internal/compile_cache.h>
 #include <internal/utils.h>
 #include <internal/utils/lua_types.h>
 #include <internal/utils/lua_utils.h>
 
 namespace luau::debugger::lua_utils {
 
+namespace {
+std::optional<int> loadAndCall(lua_State* L,
+                               const std::string& code,
+                               std::optional<std::string_view> bytecode,
+                               const std::string& error,
+                               int env_idx) {
+  if (!bytecode.has_value()) {
+    DEBUGGER_LOG_ERROR("Error compiling code: {}", error);
+    lua_pushstring(L, error.c_str());
+    return std::nullopt;
+  }
+
+  int result =
+      luau_load(L, code.c_str(), bytecode->data(), bytecode->size(), 0);
+  if (result != 0)
+    return std::nullopt;
+
+  return callWithEnv(L, env_idx);
+}
+}  // namespace
+
 std::optional<int> eval(lua_State* L, const std::string& code, int env) {
   DisableDebugStep _(L);
 
-  lua_setsafeenv(L, LUA_ENVIRONINDEX, false);
   auto env_idx = lua_absindex(L, env);
-  int top = lua_gettop(L);
+
+  std::string error;
+  auto bytecode = compile(code, error);
+  return loadAndCall(L, code, bytecode, error, env_idx);
+}
+
+std::optional<int> eval(lua_State* L,
+                        const std::string& code,
+                        int env,
+                        CompileCache& cache) {
+  DisableDebugStep _(L);
+
+  auto env_idx = lua_absindex(L, env);
+
+  std::string error;
+  auto bytecode = cache.get(code, error);
+  return loadAndCall(L, code, bytecode, error, env_idx);
+}
+
+namespace {
+// Parse and compile `source` as a chunk, parse errors are reported without
+// throwing
+std::optional<std::string> compileChunk(const std::string& source,
+                                        std::string& error) {
+  Luau::Allocator allocator;
+  Luau::AstNameTable names(allocator);
+  auto result =
+      Luau::Parser::parse(source.data(), source.size(), names, allocator);
+  if (!result.errors.empty()) {
+    error = result.errors.front().getMessage();
+    return std::nullopt;
+  }
 
   Luau::BytecodeBuilder bcb;
   try {
-    Luau::compileOrThrow(bcb, std::string("return ") + code);
-  } catch (const std::exception&) {
-    try {
-      Luau::compileOrThrow(bcb, code);
-    } catch (const std::exception& e) {
-      DEBUGGER_LOG_ERROR("Error compiling code: {}", e.what());
-      lua_pushstring(L, e.what());
-      return std::nullopt;
+    Luau::compileOrThrow(bcb, result, names);
+  } catch (const std::exception& e) {
+    // e.g. too many registers, the parse result is valid
+    error = e.what();
+    return std::nullopt;
+  }
+  return bcb.getBytecode();
+}
+
+bool isStatementKeyword(Luau::Lexeme::Type type) {
+  switch (type) {
+    case Luau::Lexeme::ReservedBreak:
+    case Luau::Lexeme::ReservedDo:
+    case Luau::Lexeme::ReservedFor:
+    case Luau::Lexeme::ReservedLocal:
+    case Luau::Lexeme::ReservedRepeat:
+    case Luau::Lexeme::ReservedReturn:
+    case Luau::Lexeme::ReservedWhile:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether an `if` after `previous` starts an if statement, which is closed by
+// `end`, rather than an if expression, which follows an operator, a bracket
+// or a keyword expecting an expression
+bool isIfStatementAfter(Luau::Lexeme::Type previous) {
+  if (previous == ')' || previous == ']' || previous == '}' ||
+      previous == ';')
+    return true;
+  switch (previous) {
+    case Luau::Lexeme::Eof:
+    case Luau::Lexeme::Name:
+    case Luau::Lexeme::Number:
+    case Luau::Lexeme::QuotedString:
+    case Luau::Lexeme::RawString:
+    case Luau::Lexeme::InterpStringEnd:
+    case Luau::Lexeme::InterpStringSimple:
+    case Luau::Lexeme::Dot3:
+    case Luau::Lexeme::ReservedTrue:
+    case Luau::Lexeme::ReservedFalse:
+    case Luau::Lexeme::ReservedNil:
+    case Luau::Lexeme::ReservedEnd:
+    case Luau::Lexeme::ReservedDo:
+    case Luau::Lexeme::ReservedThen:
+    case Luau::Lexeme::ReservedElse:
+    case Luau::Lexeme::ReservedRepeat:
+    case Luau::Lexeme::ReservedBreak:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isAssignment(Luau::Lexeme::Type type) {
+  if (type == '=')
+    return true;
+  switch (type) {
+    case Luau::Lexeme::AddAssign:
+    case Luau::Lexeme::SubAssign:
+    case Luau::Lexeme::MulAssign:
+    case Luau::Lexeme::DivAssign:
+    case Luau::Lexeme::FloorDivAssign:
+    case Luau::Lexeme::ModAssign:
+    case Luau::Lexeme::PowAssign:
+    case Luau::Lexeme::ConcatAssign:
+      return true;
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+CodeKind classify(std::string_view code) {
+  Luau::Allocator allocator;
+  Luau::AstNameTable names(allocator);
+  Luau::Lexer lexer(code.data(), code.size(), names);
+  lexer.setSkipComments(true);
+
+  const auto* token = &lexer.next();
+  if (isStatementKeyword(token->type))
+    return CodeKind::Statement;
+
+  // `function f() end` is a statement, `function() end` an expression
+  if (token->type == Luau::Lexeme::ReservedFunction &&
+      lexer.lookahead().type == Luau::Lexeme::Name)
+    return CodeKind::Statement;
+
+  // `continue` and `type` are only keywords at the start of a statement
+  if (token->type == Luau::Lexeme::Name) {
+    std::string_view name = token->name;
+    auto next = lexer.lookahead().type;
+    if ((name == "continue" && next == Luau::Lexeme::Eof) ||
+        ((name == "type" || name == "export") && next == Luau::Lexeme::Name))
+      return CodeKind::Statement;
+  }
+
+  // `if x then a else b` is an expression, an if statement is closed by `end`
+  bool leading_if = token->type == Luau::Lexeme::ReservedIf;
+
+  // Dotted names, until any other token shows up
+  bool path = true;
+  bool expect_name = true;
+  int depth = 0;
+  auto previous = Luau::Lexeme::Eof;
+  for (; token->type != Luau::Lexeme::Eof; token = &lexer.next()) {
+    auto type = token->type;
+    bool opens_if =
+        type == Luau::Lexeme::ReservedIf && isIfStatementAfter(previous);
+    previous = type;
+    if (path) {
+      if (expect_name ? type == Luau::Lexeme::Name : type == '.')
+        expect_name = !expect_name;
+      else
+        path = false;
     }
+
+    // Blocks of function expressions are nested like brackets, if
+    // expressions have no `end` and are not counted
+    if (type == '(' || type == '[' || type == '{' ||
+        type == Luau::Lexeme::ReservedFunction ||
+        type == Luau::Lexeme::ReservedDo || opens_if ||
+        type == Luau::Lexeme::ReservedRepeat)
+      ++depth;
+    else if (type == ')' || type == ']' || type == '}' ||
+             type == Luau::Lexeme::ReservedEnd ||
+             type == Luau::Lexeme::ReservedUntil) {
+      if (--depth == 0 && leading_if)
+        return CodeKind::Statement;
+    } else if (depth == 0 && (isAssignment(type) || type == ';'))
+      return CodeKind::Statement;
   }
 
-  auto bytecode = bcb.getBytecode();
-  int result = luau_load(L, code.c_str(), bytecode.data(), bytecode.size(), 0);
-  if (result != 0)
+  if (path && !expect_name)
+    return CodeKind::IdentifierPath;
+  return CodeKind::Expression;
+}
+
+std::optional<std::string> compile(const std::string& code,
+                                   std::string& error) {
+  if (classify(code) != CodeKind::Statement) {
+    if (auto bytecode = compileChunk("return " + code, error))
+      return bytecode;
+  }
+  return compileChunk(code, error);
+}
+
+std::optional<Literal> parseLiteral(std::string_view code) {
+  auto space = [](char c) {
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+  };
+  while (!code.empty() && space(code.front()))
+    code.remove_prefix(1);
+  while (!code.empty() && space(code.back()))
+    code.remove_suffix(1);
+  if (code.empty())
     return std::nullopt;
 
-  lua_pushvalue(L, env_idx);
-  lua_setfenv(L, -2);
+  Literal literal;
+  if (code == "nil")
+    return literal;
+  if (code == "true" || code == "false") {
+    literal.type_ = LUA_TBOOLEAN;
+    literal.boolean_ = code == "true";
+    return literal;
+  }
 
-  int call_result = lua_pcall(L, 0, LUA_MULTRET, 0);
-  if (call_result == LUA_OK)
-    return lua_gettop(L) - top;
-  else {
-    DEBUGGER_LOG_ERROR("Error running code: {}", lua_tostring(L, -1));
+  char quote = code.front();
+  if (quote == '"' || quote == '\'') {
+    auto content = code.substr(1, code.size() - 1);
+    if (content.empty() || content.back() != quote)
+      return std::nullopt;
+    content.remove_suffix(1);
+    if (content.find_first_of("\\\n\"'") != std::string_view::npos)
+      return std::nullopt;
+    literal.type_ = LUA_TSTRING;
+    literal.string_ = content;
+    return literal;
+  }
+
+  // Decimal numbers and hexadecimal integers, other forms such as `1_000`
+  // are compiled
+  bool negative = code.front() == '-';
+  auto digits = negative ? code.substr(1) : code;
+  double number = 0;
+  const char* end = digits.data() + digits.size();
+  std::from_chars_result parsed;
+  if (digits.starts_with("0x") || digits.starts_with("0X")) {
+    std::uint64_t integer = 0;
+    parsed = std::from_chars(digits.data() + 2, end, integer, 16);
+    number = static_cast<double>(integer);
+  } else {
+    if (digits.empty() ||
+        !(std::isdigit(static_cast<unsigned char>(digits.front())) ||
+          digits.front() == '.'))
+      return std::nullopt;
+    parsed = std::from_chars(digits.data(), end, number);
+  }
+  if (parsed.ec != std::errc() || parsed.ptr != end)
     return std::nullopt;
+  literal.type_ = LUA_TNUMBER;
+  literal.number_ = negative ? -number : number;
+  return literal;
+}
+
+void pushLiteral(lua_State* L, const Literal& literal) {
+  lua_checkstack(L, 1);
+  switch (literal.type_) {
+    case LUA_TBOOLEAN:
+      lua_pushboolean(L, literal.boolean_);
+      break;
+    case LUA_TNUMBER:
+      lua_pushnumber(L, literal.number_);
+      break;
+    case LUA_TSTRING:
+      lua_pushlstring(L, literal.string_.data(), literal.string_.size());
+      break;
+    default:
+      lua_pushnil(L);
+      break;
   }
 }
 
-std::string toString(lua_State* L, int index) {
-  return type::toString(L, index);
+bool pushLiteral(lua_State* L, std::string_view code) {
+  auto literal = parseLiteral(code);
+  if (!literal.has_value())
+    return false;
+  pushLiteral(L, *literal);
+  return true;
 }
 
-bool pushBreakEnv(lua_State* L, int level) {
-  lua_Debug ar;
-  lua_checkstack(L, 10);
+bool rawGetField(lua_State* L, int index, std::string_view key) {
+  index = lua_absindex(L, index);
+  if (!lua_istable(L, index))
+    return false;
+  lua_checkstack(L, 2);
+  lua_pushlstring(L, key.data(), key.size());
+  lua_rawget(L, index);
+  if (!lua_isnil(L, -1))
+    return true;
+
+  if (luaL_getmetafield(L, index, "__index")) {
+    lua_pop(L, 2);
+    return false;
+  }
+  return true;
+}
 
-  // Create new table for break environment
-  lua_newtable(L);
+bool pushIdentifierPath(lua_State* L, int level, std::string_view path) {
+  auto dot = path.find('.');
+  std::string root(path.substr(0, dot));
+  lua_checkstack(L, 4);
+  int top = lua_gettop(L);
 
-  // Push function at level
-  if (!lua_getinfo(L, level, "f", &ar)) {
-    DEBUGGER_LOG_ERROR("[pushBreakEnv] Failed to get function info at level {}",
-                       level);
-    lua_pop(L, 1);
-    return false;
+  // The last local with the name is the visible one
+  bool found = false;
+  for (int n = 1; const char* name = lua_getlocal(L, level, n); ++n) {
+    if (root == name) {
+      if (found)
+        lua_remove(L, -2);
+      found = true;
+    } else {
+      lua_pop(L, 1);
+    }
   }
 
-  // Get function env
-  lua_getfenv(L, -1);
+  if (!found) {
+    lua_Debug ar = {};
+    if (!lua_getinfo(L, level, "f", &ar))
+      return false;
+    int function = lua_gettop(L);
+    for (int n = 1; const char* name = lua_getupvalue(L, function, n); ++n) {
+      if (root == name) {
+        found = true;
+        break;
+      }
+      lua_pop(L, 1);
+    }
 
-  // -1: function env table
-  // -2: function
-  // -3: break env table
-  int break_env = lua_absindex(L, -3);
-  int fenv = lua_absindex(L, -1);
+    if (!found) {
+      lua_getfenv(L, function);
+      found = rawGetField(L, lua_gettop(L), root);
+      if (!found) {
+        lua_settop(L, top);
+        return false;
+      }
+      lua_remove(L, -2);
+    }
+    lua_remove(L, function);
+  }
 
-  // set fenv as metatable
-  lua_newtable(L);
-  lua_pushstring(L, "__index");
-  lua_pushvalue(L, fenv);
-  lua_rawset(L, -3);
-  lua_setmetatable(L, break_env);
-  lua_pop(L, 1);
+  while (dot != std::string_view::npos) {
+    path.remove_prefix(dot + 1);
+    dot = path.find('.');
+    if (!rawGetField(L, -1, path.substr(0, dot))) {
+      lua_settop(L, top);
+      return false;
+    }
+    lua_remove(L, -2);
+  }
+  return true;
+}
+
+std::optional<int> callWithEnv(lua_State* L, int env) {
+  DisableDebugStep _(L);
 
-  // -1: function
-  // -2: env table
+  lua_setsafeenv(L, LUA_ENVIRONINDEX, false);
+  auto env_idx = lua_absindex(L, env);
 
-  int index = 1;
-  while (auto* name = lua_getlocal(L, level, index++)) {
-    lua_pushstring(L, name);
-    lua_insert(L, -2);
+  // The function itself is not counted as a result
+  int top = lua_gettop(L) - 1;
 
-    // -1: value
-    // -2: key
-    // -3: function
-    // -4: table
-    lua_rawset(L, -4);
-  }
+  lua_checkstack(L, 1);
+  lua_pushvalue(L, env_idx);
+  lua_setfenv(L, -2);
 
-  index = 1;
-  while (auto* name = lua_getupvalue(L, -1, index++)) {
-    lua_pushstring(L, name);
-    lua_insert(L, -2);
-    lua_rawset(L, -4);
+  int call_result = lua_pcall(L, 0, LUA_MULTRET, 0);
+  if (call_result == LUA_OK)
+    return lua_gettop(L) - top;
+  else {
+    DEBUGGER_LOG_ERROR("Error running code: {}", lua_tostring(L, -1));
+    return std::nullopt;
   }
+}
 
-  // Pop function
-  lua_pop(L, 1);
+std::string toString(lua_State* L, int index) {
+  return type::toString(L, index);
+}
 
-  return true;
+bool isIdentifier(std::string_view name) {
+  static constexpr std::string_view kKeywords[] = {
+      "and", "break", "do", "else", "elseif", "end", "false", "for",
+      "function", "if", "in", "local", "nil", "not", "or", "repeat",
+      "return", "then", "true", "until", "while"};
+
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+    return false;
+  for (char c : name)
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+      return false;
+  return std::ranges::find(kKeywords, name) == std::end(kKeywords);
 }
 
 bool setLocal(lua_State* L, int level, const std::string& name, int index) {
@@ -156,6 +470,28 @@ bool setUpvalue(lua_State* L, int level, const std::string& name, int index) {
   return false;
 }
 
+namespace {
+std::atomic<int> live_refs = 0;
+}  // namespace
+
+int ref(lua_State* L, int index) {
+  int result = lua_ref(L, index);
+  if (result != LUA_REFNIL)
+    live_refs.fetch_add(1, std::memory_order_relaxed);
+  return result;
+}
+
+void unref(lua_State* L, int ref) {
+  if (ref == LUA_REFNIL)
+    return;
+  lua_unref(L, ref);
+  live_refs.fetch_sub(1, std::memory_order_relaxed);
+}
+
+int liveRefs() {
+  return live_refs.load(std::memory_order_relaxed);
+}
+
 Closure* getLuaFunction(lua_State* L, int index) {
   auto o = luaA_toobject(L, index);
   return isLfunction(o) ? clvalue(o) : nullptr;
@@ -166,6 +502,81 @@ Closure* getCFunction(lua_State* L, int index) {
   return iscfunction(o) ? clvalue(o) : nullptr;
 }
 
+Proto* getProto(lua_State* L, int level) {
+  if (level < 0 || level >= L->ci - L->base_ci)
+    return nullptr;
+
+  CallInfo* ci = L->ci - level;
+  if (!isLua(ci))
+    return nullptr;
+
+  return clvalue(ci->func)->l.p;
+}
+
+TableSize getTableSize(lua_State* L, int index) {
+  const Table* t = hvalue(luaA_toobject(L, index));
+  TableSize size;
+  size.elements_ = lua_objlen(L, index);
+  size.array_size_ = t->sizearray;
+
+  // Slots after the border in the array part and the hash part, without
+  // walking them. A hash part of one node is usually the shared empty node.
+  size.fields_ = std::max(t->sizearray - size.elements_, 0);
+  if (sizenode(t) > 1)
+    size.fields_ += sizenode(t);
+  else if (!ttisnil(gval(gnode(t, 0))))
+    ++size.fields_;
+  return size;
+}
+
+std::size_t getTableFingerprint(lua_State* L, int index) {
+  const Table* t = hvalue(luaA_toobject(L, index));
+  auto combine = [](std::size_t seed, std::size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+  };
+
+  std::size_t hash = std::hash<const void*>{}(t);
+  hash = combine(hash, std::hash<const void*>{}(t->metatable));
+  hash = combine(hash, t->readonly);
+  if (t->readonly)
+    return hash;
+
+  auto bytes = [](const auto* data, std::size_t count) {
+    return std::hash<std::string_view>{}(
+        {reinterpret_cast<const char*>(data), sizeof(*data) * count});
+  };
+  hash = combine(hash, bytes(t->array, t->sizearray));
+  hash = combine(hash, bytes(t->node, sizenode(t)));
+  return hash;
+}
+
+bool pushCallee(lua_State* L) {
+  CallInfo* ci = L->ci;
+  if (!isLua(ci) || ci->savedpc == nullptr)
+    return false;
+
+  // The interrupt is called after savedpc is advanced past the instruction
+  Proto* p = clvalue(ci->func)->l.p;
+  const Instruction* pc = ci->savedpc - 1;
+  if (pc < p->code || pc >= p->code + p->sizecode)
+    return false;
+
+  // The call instruction may be patched by a breakpoint
+  uint8_t op = LUAU_INSN_OP(*pc);
+  if (op == LOP_BREAK && p->debuginsn != nullptr)
+    op = p->debuginsn[pc - p->code];
+  if (op != LOP_CALL)
+    return false;
+
+  const TValue* func = ci->base + LUAU_INSN_A(*pc);
+  if (!ttisfunction(func) || clvalue(func)->isC)
+    return false;
+
+  lua_checkstack(L, 1);
+  luaA_pushobject(L, func);
+  return true;
+}
+
 bool replaceOrCreateFunction(lua_State* L,
                              const std::string& name,
                              lua_CFunction func) {
@@ -204,6 +615,40 @@ bool replaceOrCreateFunction(lua_State* L,
   return result;
 }
 
+bool restoreFunction(lua_State* L,
+                     const std::string& name,
+                     lua_CFunction func) {
+  StackGuard guard(L);
+  ReadOnlyGuard _(L, LUA_GLOBALSINDEX);
+  lua_getglobal(L, name.c_str());
+  if (lua_tocfunction(L, -1) != func)
+    return false;
+
+  // The original function is kept as the first upvalue
+  lua_getupvalue(L, -1, 1);
+  lua_setglobal(L, name.c_str());
+  return true;
+}
+
+bool restoreFunction(lua_State* L,
+                     const std::string& library_name,
+                     const std::string& name,
+                     lua_CFunction func) {
+  StackGuard guard(L);
+  lua_getglobal(L, library_name.c_str());
+  if (!lua_istable(L, -1))
+    return false;
+
+  ReadOnlyGuard _(L, lua_absindex(L, -1));
+  lua_getfield(L, -1, name.c_str());
+  if (lua_tocfunction(L, -1) != func)
+    return false;
+
+  lua_getupvalue(L, -1, 1);
+  lua_setfield(L, -3, name.c_str());
+  return true;
+}
+
 int callMetaProtected(lua_State* L, int obj, const char* event) {
   obj = lua_absindex(L, obj);
   lua_checkstack(L, 1);
@@ -5,10 +5,17 @@
 #include <Luau/Compiler.h>
 #include <lobject.h>
 #include <lua.h>
+#include <optional>
+#include <string>
+#include <string_view>
 
 #include <internal/log.h>
 #include <internal/utils/lua_types.h>
 
+namespace luau::debugger {
+class CompileCache;
+}
+
 namespace luau::debugger::lua_utils {
 
 // env is the index of the environment table
@@ -16,16 +23,102 @@ namespace luau::debugger::lua_utils {
 // if failed to evaluate, return nullopt and the error message is on the stack
 std::optional<int> eval(lua_State* L, const std::string& code, int env);
 
-// push a new environment table to the stack
-bool pushBreakEnv(lua_State* L, int level);
+// same as above, the bytecode is looked up in `cache` before compiling
+std::optional<int> eval(lua_State* L,
+                        const std::string& code,
+                        int env,
+                        CompileCache& cache);
+
+// How evaluated code is compiled, classified from its tokens without parsing
+enum class CodeKind {
+  // Names separated by dots, e.g. `self.pos.x`
+  IdentifierPath,
+  // Expression list, compiled as `return code`
+  Expression,
+  // Statement block, e.g. an assignment
+  Statement,
+};
+CodeKind classify(std::string_view code);
+
+// compile the code as an expression if possible, otherwise as a statement
+// if failed to compile, return nullopt and the error message is set to `error`
+// the code is parsed once, unless an expression turns out to be a block of
+// call statements
+std::optional<std::string> compile(const std::string& code, std::string& error);
+
+// Fast paths of evaluation which don't compile anything nor run lua code,
+// they return false with nothing pushed when the full evaluation is needed.
+
+// Value of a number, boolean, nil or escape-free quoted string literal
+struct Literal {
+  int type_ = LUA_TNIL;
+  bool boolean_ = false;
+  double number_ = 0;
+  std::string string_;
+};
+std::optional<Literal> parseLiteral(std::string_view code);
+void pushLiteral(lua_State* L, const Literal& literal);
+
+// push the value of the literal `code`
+bool pushLiteral(lua_State* L, std::string_view code);
+
+// push the raw field `key` of the table at `index`. Fails with nothing pushed
+// if the value is not a table, or if the field is missing and `__index`
+// could resolve it.
+bool rawGetField(lua_State* L, int index, std::string_view key);
+
+// push the value of `path`, e.g. `self.pos.x`, as seen by the function at
+// `level`: its locals, upvalues and environment, then fields read with raw
+// gets. Fails if an `__index` metamethod could be involved or a field is
+// read from a value other than a table.
+bool pushIdentifierPath(lua_State* L, int level, std::string_view path);
+
+// call the function on the top of the stack with the environment at `env`
+// return value and error convention are the same as `eval`
+std::optional<int> callWithEnv(lua_State* L, int env);
+
+// Whether `name` can be used as a field name in `a.name` or a variable name
+bool isIdentifier(std::string_view name);
 
 bool setLocal(lua_State* L, int level, const std::string& name, int index);
 
 bool setUpvalue(lua_State* L, int level, const std::string& name, int index);
 
+// Registry references held by the debugger, counted so that leaks can be
+// detected in long sessions
+int ref(lua_State* L, int index);
+void unref(lua_State* L, int ref);
+int liveRefs();
+
 Closure* getLuaFunction(lua_State* L, int index);
 Closure* getCFunction(lua_State* L, int index);
 
+// Get the prototype of the lua function running at `level` without touching
+// the stack, return nullptr if the level is invalid or a C function
+Proto* getProto(lua_State* L, int level);
+
+// Size of a table computed from its array and hash parts without calling
+// into lua, in constant time. Keys from 1 to `elements_` are the elements of
+// the table. `fields_` is the capacity left for the other entries, an upper
+// bound of their number.
+struct TableSize {
+  int elements_ = 0;
+  int fields_ = 0;
+  int array_size_ = 0;
+};
+TableSize getTableSize(lua_State* L, int index);
+
+// Hash of the raw slots of a table, the table is unchanged as long as it's
+// the same. It's linear in the size of the table, without formatting or
+// calling into lua. Readonly tables, e.g. globals of `luaL_sandbox`, are not
+// scanned.
+// A different hash does not always mean a different content.
+std::size_t getTableFingerprint(lua_State* L, int index);
+
+// Push the lua function about to be called when the thread is interrupted at
+// a call instruction, return false if it's not a call to a lua function
+bool pushCallee(lua_State* L);
+
 // Replace the function with the given name in the global table
 // If the function does not exist, create a new one and return false
 bool replaceOrCreateFunction(lua_State* L,
@@ -37,6 +130,15 @@ bool replaceOrCreateFunction(lua_State* L,
                              const std::string& name,
                              lua_CFunction func);
 
+// Restore the function replaced by `replaceOrCreateFunction` with `func`
+// Return false if the function is not replaced by `func`
+bool restoreFunction(lua_State* L, const std::string& name, lua_CFunction func);
+
+bool restoreFunction(lua_State* L,
+                     const std::string& library_name,
+                     const std::string& name,
+                     lua_CFunction func);
+
 int callMetaProtected(lua_State* L, int obj, const char* event);
 
 class StackGuard {
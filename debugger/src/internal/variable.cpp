@@ -9,6 +9,7 @@
 #include <internal/log.h>
 #include <internal/scope.h>
 #include <internal/utils.h>
+#include <internal/utils/break_env.h>
 #include <internal/utils/lua_utils.h>
 #include <internal/variable.h>
 #include <internal/variable_registry.h>
@@ -17,15 +18,23 @@ namespace luau::debugger {
 Variable::Variable(VariableRegistry* registry,
                    lua_State* L,
                    std::string_view name,
-                   int level)
-    : L_(L), name_(name), level_(level) {
+                   int level,
+                   std::string_view evaluate_name)
+    : L_(L), level_(level) {
+  auto& arena = registry->arena();
+  name_ = arena.intern(name);
+  if (!evaluate_name.empty())
+    evaluate_name_ = arena.copy(evaluate_name);
   type_ = lua_type(L, -1);
-  value_ = lua_utils::type::toString(L, -1);
+  value_ = arena.copy(
+      lua_utils::type::toPreview(L, -1, registry->formatLimits()));
+  if (type_ == LUA_TTABLE && isPlainTable(L, -1))
+    table_size_ = lua_utils::getTableSize(L, -1);
   addScope(registry, L);
 }
 
-Scope Variable::getScope() const {
-  return scope_;
+int Variable::getReference() const {
+  return reference_;
 }
 
 bool Variable::isTable() const {
@@ -48,69 +57,78 @@ std::string_view Variable::getValue() const {
   return value_;
 }
 
-std::string Variable::getType() const {
-  return lua_utils::type::getTypeName(type_);
+std::string_view Variable::getEvaluateName() const {
+  return evaluate_name_;
 }
 
-std::string Variable::setValue(Scope scope, const std::string& value) {
-  if (!lua_utils::pushBreakEnv(L_, level_))
-    throw std::runtime_error("Failed to push break environment");
-
-  auto result = lua_utils::eval(L_, preprocess(value), -1);
-  if (!result.has_value()) {
-    auto error = lua_utils::type::toString(L_, -1);
-    lua_pop(L_, 2);
-    throw std::runtime_error(error);
-  }
+std::string_view Variable::getType() const {
+  return lua_utils::type::getTypeName(type_);
+}
 
-  auto ret_count = result.value();
-  if (ret_count == 0) {
-    lua_pop(L_, 1);
-    return value_;
-  }
+std::optional<lua_utils::TableSize> Variable::getTableSize() const {
+  return table_size_;
+}
 
-  if (ret_count > 1)
-    lua_pop(L_, ret_count - 1);
+std::string Variable::setValue(Scope scope,
+                               const std::string& value,
+                               const lua_utils::type::FormatLimits& limits) {
+  lua_utils::StackGuard guard(L_);
+  if (!pushValue(value))
+    return std::string(value_);
 
-  auto new_value = lua_utils::type::toString(L_, -1);
+  auto new_value = lua_utils::type::toPreview(L_, -1, limits);
   if (scope.isTable() || scope.isUserData()) {
     if (scope.pushRef()) {
-      // -1: key
-      // -2: table | userdata
-      // -3: value
-      // -4: env
-      lua_checkstack(L_, 2);
+      // -1: table | userdata
+      // -2: value
       if (index_.has_value())
         lua_pushinteger(L_, index_.value());
       else
-        lua_pushstring(L_, name_.data());
+        lua_pushlstring(L_, name_.data(), name_.size());
       lua_pushvalue(L_, -3);
       lua_settable(L_, -3);
-      lua_pop(L_, 3);
     }
   } else if (scope.isLocal()) {
-    if (!lua_utils::setLocal(L_, level_, name_, -1)) {
-      lua_pop(L_, 2);
+    if (!lua_utils::setLocal(L_, level_, std::string(name_), -1))
       throw std::runtime_error("Failed to set local variable");
-    }
   } else if (scope.isUpvalue()) {
-    if (!lua_utils::setUpvalue(L_, level_, name_, -1)) {
-      lua_pop(L_, 2);
+    if (!lua_utils::setUpvalue(L_, level_, std::string(name_), -1))
       throw std::runtime_error("Failed to set upvalue");
-    }
   } else {
-    lua_pop(L_, 2);
     throw std::runtime_error("Invalid scope");
   }
 
-  lua_pop(L_, 2);
   return new_value;
 }
 
+bool Variable::pushValue(const std::string& input) {
+  // Strings are typed without quotes, and literals are pushed without
+  // compiling them
+  if (type_ == LUA_TSTRING) {
+    lua_pushlstring(L_, input.data(), input.size());
+    return true;
+  }
+  if (type_ != LUA_TVECTOR && lua_utils::pushLiteral(L_, input))
+    return true;
+
+  lua_utils::BreakEnv break_env(L_, level_);
+  if (!break_env.push(L_))
+    throw std::runtime_error("Failed to push break environment");
+
+  auto result = lua_utils::eval(L_, preprocess(input), -1);
+  if (!result.has_value())
+    throw std::runtime_error(lua_utils::type::toString(L_, -1));
+  if (*result == 0)
+    return false;
+
+  // Keep the first result, drop the environment
+  lua_pop(L_, *result - 1);
+  lua_remove(L_, -2);
+  return true;
+}
+
 std::string Variable::preprocess(const std::string& input_value) {
-  if (type_ == LUA_TSTRING)
-    return std::format("[[{}]]", input_value);
-  else if (type_ == LUA_TVECTOR)
+  if (type_ == LUA_TVECTOR)
     return std::format("vector.create{}", input_value);
 
   return input_value;
@@ -120,33 +138,47 @@ void Variable::addScope(VariableRegistry* registry, lua_State* L) {
   if (!hasFields())
     return;
 
-  if (isTable())
-    scope_ = Scope::createTable(L);
-  else if (isUserData())
-    scope_ = Scope::createUserData(L);
-
-  scope_.setName(name_);
-  scope_.setLevel(level_);
+  Scope scope = isTable() ? Scope::createTable(L) : Scope::createUserData(L);
+  scope.setName(std::string(name_));
+  scope.setEvaluateName(std::string(evaluate_name_));
+  scope.setLevel(level_);
+  reference_ = registry->registerScope(std::move(scope)).getKey();
+}
 
-  if (!registry->isRegistered(scope_))
-    registry->registerVariables(scope_, {});
+Variable Variable::copyInto(StopArena& arena) const {
+  Variable variable = *this;
+  variable.name_ = arena.intern(name_);
+  variable.value_ = arena.copy(value_);
+  if (!evaluate_name_.empty())
+    variable.evaluate_name_ = arena.copy(evaluate_name_);
+  return variable;
 }
 
-void Variable::loadFields(VariableRegistry* registry, const Scope& scope) {
+bool Variable::loadFields(VariableRegistry* registry, const Scope& scope) {
   auto* L = scope.getLuaState();
   lua_utils::StackGuard guard(L);
   if (!scope.pushRef())
-    return;
+    return true;
 
   int value_idx = lua_absindex(L, -1);
 
   // https://github.com/luau-lang/rfcs/blob/master/docs/generalized-iteration.md
-  if (luaL_getmetafield(L, value_idx, "__iter"))
+  auto& budget = registry->budget();
+  if (luaL_getmetafield(L, value_idx, "__iter")) {
+    ExpansionBudget::Guard _(budget);
     addIterFields(registry, L, scope, value_idx);
-  else if (hasGetters(L, value_idx))
+  } else if (hasGetters(L, value_idx)) {
+    ExpansionBudget::Guard _(budget);
     addCustomFields(registry, L, scope, value_idx);
-  else if (scope.isTable())
-    addRawFields(registry, L, scope, value_idx);
+  } else {
+    if (scope.isTable())
+      addRawFields(registry, L, scope, value_idx);
+    return true;
+  }
+
+  if (budget.status() != ExpansionBudget::Status::Ok)
+    addMoreMarker(registry, L, scope, budget);
+  return budget.status() != ExpansionBudget::Status::Cancelled;
 }
 
 void Variable::addRawFields(VariableRegistry* registry,
@@ -159,9 +191,23 @@ void Variable::addRawFields(VariableRegistry* registry,
 
   variables->clear();
 
-  lua_pushnil(L);
+  // Elements are created by pages when they are requested, start from the
+  // border when it's in the array part to skip them
+  auto size = lua_utils::getTableSize(L, value_idx);
+  if (size.elements_ > 0 && size.elements_ <= size.array_size_)
+    lua_pushinteger(L, size.elements_);
+  else
+    lua_pushnil(L);
+
   while (lua_next(L, value_idx)) {
-    variables->emplace_back(addField(L, registry, scope));
+    bool is_element = false;
+    if (lua_type(L, -2) == LUA_TNUMBER) {
+      double key = lua_tonumber(L, -2);
+      is_element = key >= 1 && key <= size.elements_ &&
+                   key == static_cast<int>(key);
+    }
+    if (!is_element)
+      variables->emplace_back(addField(L, registry, scope));
     lua_pop(L, 1);
   }
 
@@ -180,12 +226,15 @@ void Variable::addIterFields(VariableRegistry* registry,
 
   variables->clear();
 
+  // Errors raised by the interrupt when the budget is exhausted are expected
+  auto& budget = registry->budget();
   lua_pushvalue(L, value_idx);
   int call_result = lua_pcall(L, 1, 3, 0);
   if (call_result != LUA_OK) {
-    DEBUGGER_LOG_ERROR(
-        "[Variable::registryFields] Failed to call __iter for {}, error: {}",
-        scope.getName(), lua_tostring(L, -1));
+    if (budget.status() == ExpansionBudget::Status::Ok)
+      DEBUGGER_LOG_ERROR(
+          "[Variable::registryFields] Failed to call __iter for {}, error: {}",
+          scope.getName(), lua_tostring(L, -1));
     return;
   }
 
@@ -198,12 +247,14 @@ void Variable::addIterFields(VariableRegistry* registry,
   lua_pushvalue(L, init);
   while (true) {
     if (LUA_OK != lua_pcall(L, 2, 2, 0)) {
-      DEBUGGER_LOG_ERROR(
-          "[Variable::registryFields] Failed to call __iter for {}, error: {}",
-          scope.getName(), lua_tostring(L, -1));
+      if (budget.status() == ExpansionBudget::Status::Ok)
+        DEBUGGER_LOG_ERROR(
+            "[Variable::registryFields] Failed to call __iter for {}, "
+            "error: {}",
+            scope.getName(), lua_tostring(L, -1));
       return;
     }
-    if (lua_isnil(L, -2))
+    if (lua_isnil(L, -2) || !budget.consume())
       return;
 
     variables->emplace_back(addField(L, registry, scope));
@@ -229,17 +280,78 @@ void Variable::addCustomFields(VariableRegistry* registry,
 
   variables->clear();
 
+  auto& budget = registry->budget();
   lua_pushnil(L);
   while (lua_next(L, -2)) {
+    if (!budget.consume())
+      return;
     lua_pushvalue(L, value_idx);
 
-    // call getter to retrieve the value
-    lua_pcall(L, 1, 1, 0);
+    // call getter to retrieve the value, a failed getter shows its error
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+      if (budget.status() != ExpansionBudget::Status::Ok)
+        return;
+      lua_pushfstring(L, "error: %s", lua_tostring(L, -1));
+      lua_remove(L, -2);
+    }
     variables->emplace_back(addField(L, registry, scope));
     lua_pop(L, 1);
   }
 }
 
+void Variable::addMoreMarker(VariableRegistry* registry,
+                             lua_State* L,
+                             const Scope& scope,
+                             const ExpansionBudget& budget) {
+  auto* variables = registry->getVariables(scope, false);
+  if (!variables)
+    return;
+
+  std::string reason;
+  switch (budget.status()) {
+    case ExpansionBudget::Status::EntryLimit:
+      reason = std::format("stopped after {} entries",
+                           budget.limits().entries_);
+      break;
+    case ExpansionBudget::Status::Timeout:
+      reason =
+          std::format("stopped after {} ms", budget.limits().time_.count());
+      break;
+    case ExpansionBudget::Status::Cancelled:
+      reason = "cancelled";
+      break;
+    case ExpansionBudget::Status::Ok:
+      return;
+  }
+
+  lua_utils::StackGuard guard(L);
+  lua_pushlstring(L, reason.data(), reason.size());
+  variables->emplace_back(
+      registry->createVariable(L, kMoreMarker, scope.getLevel()));
+}
+
+bool Variable::isPlainTable(lua_State* L, int index) {
+  if (!lua_istable(L, index))
+    return false;
+
+  lua_utils::StackGuard guard(L);
+  index = lua_absindex(L, index);
+  if (luaL_getmetafield(L, index, "__iter"))
+    return false;
+  return !hasGetters(L, index);
+}
+
+Variable Variable::createElement(VariableRegistry* registry,
+                                 lua_State* L,
+                                 const Scope& scope,
+                                 int table,
+                                 int index) {
+  lua_utils::StackGuard guard(L);
+  lua_pushinteger(L, index);
+  lua_rawgeti(L, table, index);
+  return addField(L, registry, scope);
+}
+
 bool Variable::hasGetters(lua_State* L, int value_idx) {
   if (luaL_getmetafield(L, value_idx, "__getters") != 1)
     return false;
@@ -259,7 +371,17 @@ Variable Variable::addField(lua_State* L,
     field_name = std::format("[{}]", lua_tointeger(L, -2));
   else if (key_type == LUA_TINTEGER)
     field_name = std::format("[{}]", lua_tointeger64(L, -2, nullptr));
-  auto variable = registry->createVariable(L, field_name, scope.getLevel());
+  std::string evaluate_name;
+  if (auto parent = scope.getEvaluateName(); !parent.empty()) {
+    // `__metatable` is a pseudo field for the metatable
+    if (key_type == LUA_TSTRING && field_name != "__metatable" &&
+        lua_utils::isIdentifier(field_name))
+      evaluate_name = std::format("{}.{}", parent, field_name);
+    else if (key_type == LUA_TNUMBER || key_type == LUA_TINTEGER)
+      evaluate_name = std::format("{}{}", parent, field_name);
+  }
+  auto variable = registry->createVariable(L, field_name, scope.getLevel(),
+                                           std::move(evaluate_name));
   if (key_type == LUA_TNUMBER)
     variable.index_ = lua_tointeger(L, -2);
   else if (key_type == LUA_TINTEGER)
@@ -1,34 +1,73 @@
 #pragma once
 #include <optional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 #include <lua.h>
 
+#include <internal/expansion_budget.h>
 #include <internal/scope.h>
+#include <internal/stop_arena.h>
+#include <internal/utils/lua_types.h>
+#include <internal/utils/lua_utils.h>
 
 namespace luau::debugger {
 
 class VariableRegistry;
+
+// Strings of a variable are views into the arena of the registry, variables
+// are only valid until the end of the debug break.
 class Variable {
  public:
-  Scope getScope() const;
+  // Reference of the fields of tables and userdata, 0 otherwise
+  int getReference() const;
   bool isTable() const;
   bool isUserData() const;
   bool hasFields() const;
   std::string_view getName() const;
   std::string_view getValue() const;
-  std::string getType() const;
+  // Expression to evaluate the full value, empty if unknown
+  std::string_view getEvaluateName() const;
+  std::string_view getType() const;
+
+  // Size of plain tables, elements are paged separately from named fields
+  std::optional<lua_utils::TableSize> getTableSize() const;
+
+  // Return the preview of the new value, bounded by `limits`
+  std::string setValue(Scope scope,
+                       const std::string& value,
+                       const lua_utils::type::FormatLimits& limits);
+
+  // Copy with its strings moved to `arena`
+  Variable copyInto(StopArena& arena) const;
+
+  // Name of the pseudo field ending the fields of an expansion stopped by its
+  // budget, its value tells why
+  static constexpr std::string_view kMoreMarker = "more...";
 
-  std::string setValue(Scope scope, const std::string& value);
+  // Return false if the expansion was cancelled, the fields are partial and
+  // should be loaded again
+  static bool loadFields(VariableRegistry* registry, const Scope& scope);
 
-  static void loadFields(VariableRegistry* registry, const Scope& scope);
+  // Tables without `__iter` and `__getters`, their elements are not loaded
+  // with the fields
+  static bool isPlainTable(lua_State* L, int index);
+
+  // Create the variable of `table[index]`
+  static Variable createElement(VariableRegistry* registry,
+                                lua_State* L,
+                                const Scope& scope,
+                                int table,
+                                int index);
 
  private:
   friend class VariableRegistry;
   Variable(VariableRegistry* registry,
            lua_State* L,
            std::string_view name,
-           int level);
+           int level,
+           std::string_view evaluate_name = {});
   void addScope(VariableRegistry* registry, lua_State* L);
 
   static void addRawFields(VariableRegistry* registry,
@@ -44,21 +83,33 @@ class Variable {
                               const Scope& scope,
                               int value_idx);
 
+  static void addMoreMarker(VariableRegistry* registry,
+                            lua_State* L,
+                            const Scope& scope,
+                            const ExpansionBudget& budget);
+
   static Variable addField(lua_State* L,
                            VariableRegistry* registry,
                            const Scope& scope);
 
   static bool hasGetters(lua_State* L, int value_idx);
 
+  // Push the value typed for this variable, return false if it has none
+  bool pushValue(const std::string& input);
   std::string preprocess(const std::string& input_value);
 
  private:
   lua_State* L_ = nullptr;
   int level_ = 0;
-  std::string name_;
+  std::string_view name_;
   std::optional<int> index_ = std::nullopt;
-  std::string value_;
-  Scope scope_;
+  std::string_view value_;
+  std::string_view evaluate_name_;
+  int reference_ = 0;
   int type_ = LUA_TNIL;
+  std::optional<lua_utils::TableSize> table_size_ = std::nullopt;
 };
+
+// Variables are released with the arena, without running destructors
+static_assert(std::is_trivially_destructible_v<Variable>);
 }  // namespace luau::debugger
\ No newline at end of file
@@ -1,4 +1,9 @@
 #include <lua.h>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <string_view>
 
 #include <internal/log.h>
@@ -10,158 +15,521 @@ namespace luau::debugger {
 
 Variable VariableRegistry::createVariable(lua_State* L,
                                           std::string_view name,
-                                          int level) {
-  return Variable(this, L, name, level);
+                                          int level,
+                                          std::string_view evaluate_name) {
+  return Variable(this, L, name, level, evaluate_name);
 }
 
-std::vector<Variable>* VariableRegistry::registerVariables(
-    Scope scope,
-    std::vector<Variable> variables) {
-  auto result = variables_.try_emplace(scope, std::move(variables));
-  if (!result.second)
-    DEBUGGER_LOG_ERROR("Variable already registered: {}",
-                       result.first->first.getName());
-  return &result.first->second;
+namespace {
+// Handles are positive ints: the slot index + 1 in the low bits and the
+// generation of the slot in the high bits
+constexpr int kIndexBits = 20;
+constexpr std::uint32_t kIndexMask = (1u << kIndexBits) - 1;
+constexpr std::uint32_t kGenerationMask = (1u << (31 - kIndexBits)) - 1;
+
+int makeHandle(std::uint32_t index, std::uint32_t generation) {
+  return static_cast<int>(((generation & kGenerationMask) << kIndexBits) |
+                          (index + 1));
 }
 
-std::vector<Variable>* VariableRegistry::registerOrUpdateVariables(
-    Scope scope,
-    std::vector<Variable> variables) {
-  auto it = variables_.find(scope);
-  if (it == variables_.end())
-    return registerVariables(scope, std::move(variables));
+// Variables of pmr vectors are bound to an arena, the vector is created again
+// to move it to another arena
+void rebind(VariableRegistry::Variables& variables,
+            StopArena& arena,
+            bool keep) {
+  VariableRegistry::Variables rebound(arena.resource());
+  if (keep) {
+    rebound.reserve(variables.size());
+    for (const auto& variable : variables)
+      rebound.emplace_back(variable.copyInto(arena));
+  }
+  std::destroy_at(&variables);
+  std::construct_at(&variables, std::move(rebound));
+}
+}  // namespace
 
-  it->second = std::move(variables);
-  return &it->second;
+VariableRegistry::Identity VariableRegistry::Identity::of(const Scope& scope) {
+  if (scope.isTable() || scope.isUserData())
+    return {scope.getType(), scope.getAddress(), 0};
+  if (scope.isGlobal())
+    return {scope.getType(), nullptr, 0};
+  return {scope.getType(), scope.getLuaState(), scope.getLevel()};
 }
 
-bool VariableRegistry::isRegistered(Scope scope) const {
-  return variables_.find(scope) != variables_.end();
+std::size_t VariableRegistry::Identity::Hash::operator()(
+    const Identity& identity) const {
+  std::size_t hash = std::hash<const void*>{}(identity.object_);
+  hash ^= std::hash<int>{}(identity.level_) + 0x9e3779b9 + (hash << 6) +
+          (hash >> 2);
+  return hash ^ static_cast<std::size_t>(identity.type_);
 }
 
-std::vector<Variable>* VariableRegistry::getVariables(Scope scope, bool load) {
-  auto it = variables_.find(scope);
-  if (it == variables_.end()) {
-    DEBUGGER_LOG_ERROR("Variable not found: {}", scope.getKey());
-    return nullptr;
+Scope VariableRegistry::registerScope(Scope scope) {
+  auto identity = Identity::of(scope);
+  if (auto it = identities_.find(identity); it != identities_.end()) {
+    auto& slot = slots_[it->second];
+    slot.visited_ = true;
+    // The thread of a previous break may be gone
+    slot.scope_.setLuaState(scope.getLuaState());
+    return slot.scope_;
   }
 
-  if (load && !it->first.isLoaded()) {
-    Variable::loadFields(this, it->first);
-    it->first.markLoaded();
+  std::uint32_t index = 0;
+  if (!free_slots_.empty()) {
+    index = free_slots_.front();
+    free_slots_.pop_front();
+  } else if (slots_.size() < kIndexMask) {
+    index = static_cast<std::uint32_t>(slots_.size());
+    slots_.emplace_back();
+  } else {
+    DEBUGGER_LOG_ERROR("Too many scopes registered: {}", slots_.size());
+    return Scope();
   }
 
-  return &it->second;
+  auto& slot = slots_[index];
+  slot.used_ = true;
+  slot.visited_ = true;
+  slot.stale_ = false;
+  slot.fingerprint_ = std::nullopt;
+  slot.identity_ = identity;
+  scope.key_ = makeHandle(index, slot.generation_);
+  scope.markUnloaded();
+  slot.scope_ = std::move(scope);
+  rebind(slot.variables_, arena(), false);
+  identities_.emplace(identity, index);
+  return slot.scope_;
 }
 
-std::pair<const Scope, std::vector<Variable>>* VariableRegistry::getVariables(
-    int reference) {
-  Scope scope(reference);
-  auto it = variables_.find(scope);
-  if (it == variables_.end()) {
-    DEBUGGER_LOG_ERROR("Variable not found: {}", scope.getKey());
+VariableRegistry::Slot* VariableRegistry::findSlot(int reference) {
+  if (reference <= 0)
     return nullptr;
-  }
 
-  return &(*it);
-}
+  auto handle = static_cast<std::uint32_t>(reference);
+  std::uint32_t index = (handle & kIndexMask) - 1;
+  if (index >= slots_.size())
+    return nullptr;
 
-void VariableRegistry::clear() {
-  variables_.clear();
+  auto& slot = slots_[index];
+  if (!slot.used_ || (slot.generation_ & kGenerationMask) !=
+                         (handle >> kIndexBits))
+    return nullptr;
+
+  // Frame scopes of a previous break are registered again by scopes requests
+  if (slot.scope_.getLuaState() == nullptr)
+    return nullptr;
+  return &slot;
 }
 
-void VariableRegistry::update(
-    std::vector<std::vector<lua_State*>> vm_with_ancestors) {
-  if (vm_with_ancestors.empty())
+void VariableRegistry::releaseSlot(std::uint32_t index, StopArena& arena) {
+  auto& slot = slots_[index];
+  identities_.erase(slot.identity_);
+  slot.scope_ = Scope();
+  rebind(slot.variables_, arena, false);
+  slot.used_ = false;
+  slot.visited_ = false;
+  slot.stale_ = false;
+  slot.fingerprint_ = std::nullopt;
+  // Handles keep few generation bits, a slot whose generation is exhausted
+  // is retired instead of reused
+  if (slot.generation_ >= kGenerationMask)
     return;
+  ++slot.generation_;
+  free_slots_.push_back(index);
+}
 
-  auto* first_state = vm_with_ancestors[0][0];
-  lua_utils::DisableDebugStep _(first_state);
+void VariableRegistry::forEachSlot(const std::function<void(Slot&)>& fn) {
+  for (auto& slot : slots_) {
+    if (slot.used_)
+      fn(slot);
+  }
+}
+
+std::optional<std::size_t> VariableRegistry::getFingerprint(
+    const Scope& scope) const {
+  if (!scope.isTable())
+    return std::nullopt;
+
+  lua_State* L = scope.getLuaState();
+  lua_utils::StackGuard guard(L);
+  if (!scope.pushRef() || !Variable::isPlainTable(L, -1))
+    return std::nullopt;
+  return lua_utils::getTableFingerprint(L, -1);
+}
+
+const Scope* VariableRegistry::findScope(int reference) {
+  auto* slot = findSlot(reference);
+  if (slot == nullptr) {
+    DEBUGGER_LOG_ERROR("Variable not found: {}", reference);
+    return nullptr;
+  }
+  return &slot->scope_;
+}
 
-  for (const auto& chain : vm_with_ancestors) {
-    depth_ = 0;
-    lua_State* src = chain[0];
-    for (lua_State* L : chain)
-      fetch(L, src);
+VariableRegistry::Variables* VariableRegistry::getVariables(const Scope& scope,
+                                                           bool load) {
+  auto* slot = findSlot(scope.getKey());
+  if (slot == nullptr) {
+    DEBUGGER_LOG_ERROR("Variable not found: {}", scope.getKey());
+    return nullptr;
   }
+  if (!load)
+    return &slot->variables_;
 
-  fetchGlobals(first_state);
-  clearDirtyScopes();
+  slot->visited_ = true;
+  if (slot->stale_) {
+    slot->stale_ = false;
+    if (slot->fingerprint_ != getFingerprint(slot->scope_)) {
+      slot->variables_.clear();
+      slot->scope_.markUnloaded();
+    }
+  }
+
+  if (!slot->scope_.isLoaded() && this->load(slot->scope_, slot->variables_)) {
+    slot->scope_.markLoaded();
+    slot->fingerprint_ = getFingerprint(slot->scope_);
+  }
+  return &slot->variables_;
 }
 
-void VariableRegistry::fetch(lua_State* L, lua_State* src) {
+bool VariableRegistry::visitVariables(Scope scope,
+                                      const VariablesPage& page,
+                                      const VariableVisitor& visit) {
+  auto* variables = getVariables(scope, true);
+  if (variables == nullptr)
+    return false;
+
+  const Scope& registered = *findScope(scope.getKey());
+  lua_State* L = registered.getLuaState();
   lua_utils::StackGuard guard(L);
-  lua_Debug ar;
-  for (int level = 0; lua_getinfo(L, level, "sln", &ar); ++level) {
-    if (ar.what[0] == 'C')
-      continue;
-    fetchFromStack(L, level, src);
-    ++depth_;
+
+  // Elements of plain tables are not loaded with the fields
+  int elements = 0;
+  int table = 0;
+  if (registered.isTable() && registered.pushRef() &&
+      Variable::isPlainTable(L, -1)) {
+    table = lua_absindex(L, -1);
+    elements = lua_objlen(L, table);
+  }
+
+  using Filter = VariablesPage::Filter;
+  int begin = std::max(page.start_, 0);
+  int end = page.count_ > 0 ? begin + page.count_
+                            : std::numeric_limits<int>::max();
+
+  int position = 0;
+  if (page.filter_ != Filter::Named) {
+    for (int i = begin; i < std::min(end, elements); ++i)
+      visit(Variable::createElement(this, L, registered, table, i + 1));
+    position = elements;
   }
+
+  if (page.filter_ != Filter::Indexed) {
+    for (const auto& variable : *variables) {
+      if (position >= end)
+        break;
+      if (position++ >= begin)
+        visit(variable);
+    }
+  }
+  return true;
 }
 
-void VariableRegistry::fetchGlobals(lua_State* L) {
+std::optional<Variable> VariableRegistry::findElement(const Scope& scope,
+                                                     std::string_view name) {
+  if (!scope.isTable() || name.size() < 3 || name.front() != '[' ||
+      name.back() != ']')
+    return std::nullopt;
+
+  int index = 0;
+  auto digits = name.substr(1, name.size() - 2);
+  auto [end, error] =
+      std::from_chars(digits.data(), digits.data() + digits.size(), index);
+  if (error != std::errc{} || end != digits.data() + digits.size())
+    return std::nullopt;
+
+  lua_State* L = scope.getLuaState();
   lua_utils::StackGuard guard(L);
-  lua_Debug ar;
-  lua_getinfo(L, 0, "f", &ar);
-  lua_getfenv(L, -1);
-  std::vector<Variable> globals;
-  lua_pushnil(L);
-  while (lua_next(L, -2)) {
-    std::string name = lua_utils::type::toString(L, -2);
-    globals.emplace_back(createVariable(L, name, -1));
-    lua_pop(L, 1);
-  }
+  if (!scope.pushRef() || !Variable::isPlainTable(L, -1))
+    return std::nullopt;
 
-  if (lua_getmetatable(L, -1))
-    globals.emplace_back(createVariable(L, "__metatable", -1));
+  int table = lua_absindex(L, -1);
+  if (index < 1 || index > lua_objlen(L, table))
+    return std::nullopt;
+  return Variable::createElement(this, L, scope, table, index);
+}
 
-  registerOrUpdateVariables(getGlobalScope(), std::move(globals));
+void VariableRegistry::clear() {
+  identities_.clear();
+  free_slots_.clear();
+  slots_.clear();
+  for (auto& arena : arenas_)
+    arena.reset();
 }
 
-void VariableRegistry::clearDirtyScopes() {
-  for (auto& [scope, variables] : variables_)
-    if (scope.isTable() || scope.isUserData()) {
-      variables.clear();
-      scope.markUnloaded();
+void VariableRegistry::beginBreak(lua_State* L) {
+  forEachSlot([L](Slot& slot) {
+    if (slot.scope_.isTable() || slot.scope_.isUserData())
+      slot.scope_.setLuaState(L);
+  });
+}
+
+void VariableRegistry::endBreak() {
+  auto& next = arenas_[1 - current_arena_];
+
+  // Variables of loaded plain tables are kept, the scopes they reference
+  // should be kept as well
+  std::vector<bool> keeps_variables(slots_.size());
+  for (std::uint32_t index = 0; index < slots_.size(); ++index) {
+    const auto& slot = slots_[index];
+    keeps_variables[index] = slot.used_ && slot.visited_ &&
+                             slot.scope_.isLoaded() &&
+                             slot.fingerprint_.has_value();
+  }
+  for (std::uint32_t index = 0; index < slots_.size(); ++index) {
+    if (!keeps_variables[index])
+      continue;
+    for (const auto& variable : slots_[index].variables_) {
+      if (auto* child = findSlot(variable.getReference()))
+        child->visited_ = true;
+    }
+  }
+
+  for (std::uint32_t index = 0; index < slots_.size(); ++index) {
+    auto& slot = slots_[index];
+    if (!slot.used_)
+      continue;
+    if (!slot.visited_) {
+      releaseSlot(index, next);
+      continue;
     }
+
+    bool keep = keeps_variables[index];
+    rebind(slot.variables_, next, keep);
+    slot.stale_ = keep;
+    slot.visited_ = false;
+    if (!keep)
+      slot.scope_.markUnloaded();
+
+    // Variables of frames change with every break
+    if (slot.scope_.isLocal() || slot.scope_.isUpvalue() ||
+        slot.scope_.isGlobal())
+      slot.scope_.setLuaState(nullptr);
+  }
+
+  arena().reset();
+  current_arena_ = 1 - current_arena_;
 }
 
-Scope VariableRegistry::getLocalScope(lua_State* L, int level) {
-  return Scope::createLocal(
-      std::format("___locals__{}_{}", level, static_cast<void*>(L)));
+void VariableRegistry::invalidate() {
+  forEachSlot([](Slot& slot) {
+    slot.variables_.clear();
+    slot.scope_.markUnloaded();
+  });
 }
 
-Scope VariableRegistry::getUpvalueScope(lua_State* L, int level) {
-  return Scope::createUpvalue(
-      std::format("___upvalues__{}_{}", level, static_cast<void*>(L)));
+std::vector<Scope> VariableRegistry::invalidate(Scope scope) {
+  std::vector<Scope> invalidated;
+  auto invalidate_if = [&](auto&& touches) {
+    forEachSlot([&](Slot& slot) {
+      if (!slot.scope_.isLoaded() || !touches(slot.scope_))
+        return;
+      slot.variables_.clear();
+      slot.scope_.markUnloaded();
+      invalidated.push_back(slot.scope_);
+    });
+  };
+
+  lua_State* L = scope.getLuaState();
+  int level = scope.getLevel();
+  if (scope.isLocal()) {
+    // Closures running in deeper frames may capture the local
+    invalidate_if([&](const Scope& other) {
+      if (other.getLuaState() != L)
+        return false;
+      return other == scope || (other.isUpvalue() && other.getLevel() < level);
+    });
+  } else if (scope.isUpvalue()) {
+    // Upvalues are shared between closures and may be open on a local of any
+    // frame
+    invalidate_if([](const Scope& other) {
+      return other.isLocal() || other.isUpvalue();
+    });
+  } else if (scope.isGlobal()) {
+    invalidate_if([&](const Scope& other) {
+      return other == scope || isEnvironmentOf(other, scope);
+    });
+  } else {
+    invalidate_if([&](const Scope& other) {
+      return other == scope ||
+             (other.isGlobal() && isEnvironmentOf(scope, other));
+    });
+  }
+  return invalidated;
+}
+
+void VariableRegistry::invalidateTables() {
+  forEachSlot([](Slot& slot) {
+    if (!slot.scope_.isTable() && !slot.scope_.isUserData())
+      return;
+    slot.variables_.clear();
+    slot.scope_.markUnloaded();
+  });
+}
+
+bool VariableRegistry::isEnvironmentOf(const Scope& table,
+                                       const Scope& globals) const {
+  if (!table.isTable())
+    return false;
+
+  // The scopes may belong to different threads
+  const void* env = nullptr;
+  {
+    lua_State* L = globals.getLuaState();
+    lua_utils::StackGuard guard(L);
+    lua_Debug ar = {};
+    if (!lua_getinfo(L, 0, "f", &ar))
+      return false;
+    lua_getfenv(L, -1);
+    env = lua_topointer(L, -1);
+  }
+
+  lua_State* L = table.getLuaState();
+  lua_utils::StackGuard guard(L);
+  return table.pushRef() && lua_topointer(L, -1) == env;
 }
 
-Scope VariableRegistry::getGlobalScope() {
-  return Scope::createGlobal("___globals__");
+bool VariableRegistry::load(const Scope& scope, Variables& variables) {
+  if (scope.isLocal())
+    fetchLocals(scope, variables);
+  else if (scope.isUpvalue())
+    fetchUpvalues(scope, variables);
+  else if (scope.isGlobal())
+    fetchGlobals(scope, variables);
+  else
+    return Variable::loadFields(this, scope);
+  return true;
 }
 
-void VariableRegistry::fetchFromStack(lua_State* L, int level, lua_State* src) {
-  // Register local variables
-  std::vector<Variable> variables;
+void VariableRegistry::fetchLocals(const Scope& scope, Variables& variables) {
+  lua_State* L = scope.getLuaState();
+  lua_utils::StackGuard guard(L);
+  variables.clear();
+
   int index = 1;
-  while (const char* name = lua_getlocal(L, level, index++)) {
-    variables.emplace_back(createVariable(L, name, level));
+  while (const char* name = lua_getlocal(L, scope.getLevel(), index++)) {
+    variables.emplace_back(createVariable(L, name, scope.getLevel(), name));
     lua_pop(L, 1);
   }
-  registerOrUpdateVariables(getLocalScope(src, depth_), std::move(variables));
+}
+
+void VariableRegistry::fetchUpvalues(const Scope& scope,
+                                     Variables& variables) {
+  lua_State* L = scope.getLuaState();
+  lua_utils::StackGuard guard(L);
+  variables.clear();
 
-  // Register upvalues
   lua_Debug ar = {};
-  lua_getinfo(L, level, "f", &ar);
-  std::vector<Variable> upvalues;
-  index = 1;
+  if (!lua_getinfo(L, scope.getLevel(), "f", &ar))
+    return;
+
+  int index = 1;
   while (const char* name = lua_getupvalue(L, -1, index++)) {
-    upvalues.emplace_back(createVariable(L, name, level));
+    variables.emplace_back(createVariable(L, name, scope.getLevel(), name));
     lua_pop(L, 1);
   }
-  lua_pop(L, 1);
-  registerOrUpdateVariables(getUpvalueScope(src, depth_), std::move(upvalues));
 }
 
-}  // namespace luau::debugger
\ No newline at end of file
+void VariableRegistry::fetchGlobals(const Scope& scope,
+                                    Variables& variables) {
+  lua_State* L = scope.getLuaState();
+  lua_utils::StackGuard guard(L);
+  variables.clear();
+
+  lua_Debug ar;
+  if (!lua_getinfo(L, 0, "f", &ar))
+    return;
+  lua_getfenv(L, -1);
+
+  // Globals rarely change between breaks, listing them again is only needed
+  // when the environment table is changed. The check still hashes every raw
+  // slot of the environment on each fetch, it saves the formatting only.
+  auto& cache = globals_cache_;
+  const void* env = lua_topointer(L, -1);
+  std::size_t fingerprint = lua_utils::getTableFingerprint(L, -1);
+  if (cache.env_ != env || cache.fingerprint_ != fingerprint) {
+    DEBUGGER_LOG_INFO("[fetchGlobals] Globals changed, formatting them");
+    releaseCache();
+    cache.env_ = env;
+    cache.fingerprint_ = fingerprint;
+
+    auto add = [&](Variable variable) {
+      cache.variables_.emplace_back(variable.copyInto(cache.arena_));
+      auto* child = findSlot(variable.getReference());
+      cache.scopes_.emplace_back(child != nullptr ? child->scope_ : Scope());
+    };
+
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      std::string name = lua_utils::type::toString(L, -2);
+      bool is_identifier = lua_type(L, -2) == LUA_TSTRING &&
+                           lua_utils::isIdentifier(name);
+      std::string_view evaluate_name =
+          is_identifier ? std::string_view(name) : std::string_view{};
+      add(createVariable(L, name, -1, evaluate_name));
+      lua_pop(L, 1);
+    }
+
+    if (lua_getmetatable(L, -1))
+      add(createVariable(L, "__metatable", -1));
+  }
+
+  // Previews of tables and userdata depend on their contents and on
+  // `__tostring`, which the fingerprint does not cover. They are formatted
+  // again from the cached value, the others are copied to the break, the
+  // cache may be released before the break ends.
+  variables.reserve(cache.variables_.size());
+  for (std::size_t i = 0; i < cache.variables_.size(); ++i) {
+    Variable variable = cache.variables_[i].copyInto(arena());
+    variable.L_ = L;
+    if (variable.reference_ != 0) {
+      Scope child = cache.scopes_[i];
+      child.setLuaState(L);
+      if (child.pushRef()) {
+        variable = createVariable(L, variable.getName(), -1,
+                                  variable.getEvaluateName());
+        lua_pop(L, 1);
+      } else
+        variable.reference_ = 0;
+    }
+    variables.emplace_back(variable);
+  }
+}
+
+void VariableRegistry::setFormatLimits(lua_utils::type::FormatLimits limits) {
+  format_limits_ = limits;
+  // Cached globals were formatted with the previous limits
+  releaseCache();
+}
+
+void VariableRegistry::releaseCache() {
+  auto& cache = globals_cache_;
+  cache.env_ = nullptr;
+  cache.fingerprint_ = 0;
+  cache.variables_.clear();
+  cache.scopes_.clear();
+  cache.arena_.reset();
+}
+
+Scope VariableRegistry::getLocalScope(lua_State* L, int level) {
+  return registerScope(Scope::createLocal("___locals__", L, level));
+}
+
+Scope VariableRegistry::getUpvalueScope(lua_State* L, int level) {
+  return registerScope(Scope::createUpvalue("___upvalues__", L, level));
+}
+
+Scope VariableRegistry::getGlobalScope(lua_State* L) {
+  return registerScope(Scope::createGlobal("___globals__", L));
+}
+
+}  // namespace luau::debugger
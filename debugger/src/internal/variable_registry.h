@@ -1,46 +1,181 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory_resource>
+#include <optional>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include <lua.h>
-#include <vector>
 
+#include <internal/expansion_budget.h>
 #include <internal/scope.h>
+#include <internal/stop_arena.h>
 #include <internal/variable.h>
 
 namespace luau::debugger {
 
+// Range of variables requested by the client, elements of plain tables come
+// first and named fields follow
+struct VariablesPage {
+  enum class Filter { All, Indexed, Named };
+  Filter filter_ = Filter::All;
+  int start_ = 0;
+  // 0 for all variables after `start_`
+  int count_ = 0;
+};
+
+// Scopes are stored in a slot map, their references are handles made of the
+// slot index and a generation counter which is bumped when the slot is
+// released. References are limited to 31 bits by DAP, so slots are reused
+// in FIFO order and retired when their generation is exhausted: a handle of
+// a released scope is never resolved to another one.
+//
+// Scopes registered in a break are kept for the next one with the same
+// reference, so that the client can expand them again. Plain tables also keep
+// their variables, which are reused as long as the table is unchanged.
 class VariableRegistry {
  public:
+  // Variables of a scope, allocated in the arena of the current break
+  using Variables = std::pmr::vector<Variable>;
+
+  // Release all scopes and variables
   void clear();
-  void update(std::vector<std::vector<lua_State*>> vm_with_ancestors);
 
+  // Scopes of a previous break listing tables and userdata are moved to the
+  // thread `L` of the new break
+  void beginBreak(lua_State* L);
+
+  // Release the scopes which were not registered during the break, keep the
+  // others and the variables of unchanged plain tables for the next break.
+  // The arena of the break is reset at once.
+  void endBreak();
+
+  // Drop the globals kept across breaks, before the lua state is closed
+  void releaseCache();
+
+  // Variables of all scopes are fetched again when they are requested
+  void invalidate();
+
+  // Invalidate the loaded scopes that a change of a variable in `scope` could
+  // touch, return them
+  std::vector<Scope> invalidate(Scope scope);
+
+  // Invalidate the loaded tables and userdata, any field may have changed
+  void invalidateTables();
+
+  // Register the scopes of the frame at `level` of thread `L`, they are only
+  // descriptors until their variables are requested
   Scope getLocalScope(lua_State* L, int level);
   Scope getUpvalueScope(lua_State* L, int level);
-  Scope getGlobalScope();
+  Scope getGlobalScope(lua_State* L);
+
+  Variable createVariable(lua_State* L,
+                          std::string_view name,
+                          int level,
+                          std::string_view evaluate_name = {});
 
-  Variable createVariable(lua_State* L, std::string_view name, int level);
+  // Register a scope, or find the scope already registered for the same
+  // frame or object. The returned scope holds its reference.
+  Scope registerScope(Scope scope);
+  const Scope* findScope(int reference);
+  Variables* getVariables(const Scope& scope, bool load);
 
-  std::vector<Variable>* registerVariables(Scope scope,
-                                           std::vector<Variable> variables);
-  std::vector<Variable>* registerOrUpdateVariables(
-      Scope scope,
-      std::vector<Variable> variables);
-  bool isRegistered(Scope scope) const;
-  std::vector<Variable>* getVariables(Scope scope, bool load);
-  std::pair<const Scope, std::vector<Variable>>* getVariables(int reference);
+  StopArena& arena() { return arenas_[current_arena_]; }
 
-  void fetchGlobals(lua_State* L);
-  void clearDirtyScopes();
+  // Bounds the expansion of values with `__iter` or `__getters`
+  ExpansionBudget& budget() { return budget_; }
+
+  // Bounds the previews of values
+  const lua_utils::type::FormatLimits& formatLimits() const {
+    return format_limits_;
+  }
+  void setFormatLimits(lua_utils::type::FormatLimits limits);
+
+  // Find the element of a plain table scope by its variable name, e.g. `[1]`
+  std::optional<Variable> findElement(const Scope& scope,
+                                      std::string_view name);
+
+  // Visit the variables of `page`, table elements are created for the page
+  // only. Return false if the scope is not registered.
+  using VariableVisitor = std::function<void(const Variable&)>;
+  bool visitVariables(Scope scope,
+                      const VariablesPage& page,
+                      const VariableVisitor& visit);
+
+ private:
+  // Whether `table` is the environment that the global scope `globals` lists
+  bool isEnvironmentOf(const Scope& table, const Scope& globals) const;
+  // Return false if the loading was cancelled
+  bool load(const Scope& scope, Variables& variables);
+
+  void fetchLocals(const Scope& scope, Variables& variables);
+  void fetchUpvalues(const Scope& scope, Variables& variables);
+  void fetchGlobals(const Scope& scope, Variables& variables);
 
  private:
-  void fetch(lua_State* L, lua_State* src);
-  void fetchFromStack(lua_State* L, int level, lua_State* src);
+  // Frame or object listed by a scope
+  struct Identity {
+    ScopeType type_ = ScopeType::Unknown;
+    const void* object_ = nullptr;
+    int level_ = 0;
+
+    static Identity of(const Scope& scope);
+    bool operator==(const Identity& other) const = default;
+    struct Hash {
+      std::size_t operator()(const Identity& identity) const;
+    };
+  };
+
+  struct Slot {
+    std::uint32_t generation_ = 0;
+    Identity identity_ = {};
+    bool used_ = false;
+    // Registered or requested during the current break
+    bool visited_ = false;
+    // Variables kept from a previous break, checked against `fingerprint_`
+    // before they are used
+    bool stale_ = false;
+    // Fingerprint of plain tables when their variables are loaded
+    std::optional<std::size_t> fingerprint_;
+    Scope scope_;
+    Variables variables_;
+  };
+
+  Slot* findSlot(int reference);
+  void releaseSlot(std::uint32_t index, StopArena& arena);
+  void forEachSlot(const std::function<void(Slot&)>& fn);
+  std::optional<std::size_t> getFingerprint(const Scope& scope) const;
 
  private:
-  std::unordered_map<Scope, std::vector<Variable>> variables_;
-  int depth_ = 0;
+  // Declared first, the variables are allocated in them. Variables kept for
+  // the next break are copied to the other arena when a break ends.
+  StopArena arenas_[2];
+  int current_arena_ = 0;
+
+  // Deque, the addresses of slots do not change when it grows
+  std::deque<Slot> slots_;
+  // Released slots, oldest first
+  std::deque<std::uint32_t> free_slots_;
+  std::unordered_map<Identity, std::uint32_t, Identity::Hash> identities_;
+
+  // Globals listed at a previous break, reused while the environment table
+  // keeps the same fingerprint
+  struct GlobalsCache {
+    const void* env_ = nullptr;
+    std::size_t fingerprint_ = 0;
+    StopArena arena_;
+    std::vector<Variable> variables_;
+    // Scopes of the table and userdata globals, by index of the variables
+    std::vector<Scope> scopes_;
+  };
+  GlobalsCache globals_cache_;
+
+  ExpansionBudget budget_;
+  lua_utils::type::FormatLimits format_limits_;
 };
 
 }  // namespace luau::debugger
\ No newline at end of file
@@ -30,15 +30,20 @@ void VMRegistry::releaseVM(lua_State* L) {
   }
 }
 
+void VMRegistry::setSingleStep(bool enable) {
+  for (auto* L : alive_threads_)
+    lua_singlestep(L, enable);
+}
+
 bool VMRegistry::isAlive(lua_State* L) const {
   return alive_threads_.find(L) != alive_threads_.end();
 }
 
 lua_State* VMRegistry::getParent(lua_State* L) const {
-  auto it = std::find(thread_stack_.begin(), thread_stack_.end(), L);
+  auto it = findStack(L);
   if (it != thread_stack_.end())
-    return it == thread_stack_.begin() ? nullptr : *(it - 1);
-  return thread_stack_.empty() ? nullptr : thread_stack_.back();
+    return it == thread_stack_.begin() ? nullptr : (it - 1)->L_;
+  return thread_stack_.empty() ? nullptr : thread_stack_.back().L_;
 }
 
 lua_State* VMRegistry::getRoot(lua_State* L) const {
@@ -49,14 +54,13 @@ lua_State* VMRegistry::getRoot(lua_State* L) const {
 }
 
 bool VMRegistry::isChild(lua_State* L, lua_State* parent) const {
-  lua_State* current = L;
-  while (auto* p = getParent(current)) {
-    if (p == parent)
-      return true;
-    else
-      current = p;
-  }
-  return false;
+  // Threads in the stack are ancestors of the threads after them and of the
+  // running thread
+  auto parent_it = findStack(parent);
+  if (parent_it == thread_stack_.end())
+    return false;
+  auto it = findStack(L);
+  return it == thread_stack_.end() || it > parent_it;
 }
 
 void VMRegistry::markAlive(lua_State* L, lua_State* _) {
@@ -110,11 +114,17 @@ lua_State* VMRegistry::getThread(int key) const {
 }
 
 void VMRegistry::pushStack(lua_State* L) {
-  thread_stack_.push_back(L);
+  thread_stack_.push_back(ResumeFrame{L, getResumeDepth() + lua_stackdepth(L)});
 }
 
 void VMRegistry::popStack() {
   thread_stack_.pop_back();
 }
 
+std::vector<VMRegistry::ResumeFrame>::const_iterator VMRegistry::findStack(
+    lua_State* L) const {
+  return std::find_if(thread_stack_.begin(), thread_stack_.end(),
+                      [L](const ResumeFrame& frame) { return frame.L_ == L; });
+}
+
 }  // namespace luau::debugger
\ No newline at end of file
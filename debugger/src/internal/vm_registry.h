@@ -19,6 +19,10 @@ class VMRegistry {
   ~VMRegistry();
   void registerVM(lua_State* L);
   void releaseVM(lua_State* L);
+  const std::vector<lua_State*>& getVMs() const { return lua_vms_; }
+
+  // Toggle single step mode for all alive threads
+  void setSingleStep(bool enable);
 
   bool isAlive(lua_State* L) const;
   bool isChild(lua_State* L, lua_State* parent) const;
@@ -35,13 +39,27 @@ class VMRegistry {
   static std::string getThreadName(lua_State* L);
   lua_State* getThread(int key) const;
 
+  // Called before thread L resumes a coroutine and after it returns
   void pushStack(lua_State* L);
   void popStack();
 
+  // Total stack depth of the threads resuming the running thread
+  int getResumeDepth() const {
+    return thread_stack_.empty() ? 0 : thread_stack_.back().depth_;
+  }
+
+ private:
+  struct ResumeFrame {
+    lua_State* L_ = nullptr;
+    // Total stack depth of L_ and its ancestors when resuming
+    int depth_ = 0;
+  };
+  std::vector<ResumeFrame>::const_iterator findStack(lua_State* L) const;
+
  private:
   std::vector<lua_State*> lua_vms_;
   std::unordered_set<lua_State*> alive_threads_;
 
-  std::vector<lua_State*> thread_stack_;
+  std::vector<ResumeFrame> thread_stack_;
 };
 }  // namespace luau::debugger